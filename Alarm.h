@@ -0,0 +1,49 @@
+/*
+  Alarm.h - Alarm definition.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _Alarm_h
+#define _Alarm_h
+
+#include "Arduino.h"
+
+// number of alarm slots, override at build time with -DALARM_CAPACITY=n
+#ifndef ALARM_CAPACITY
+#define ALARM_CAPACITY 7
+#endif
+
+static_assert(ALARM_CAPACITY > 0 && ALARM_CAPACITY < 255, "ALARM_CAPACITY must be 1-254, 255 is reserved as 'no alarm'");
+
+#define SUNRISE_SECONDS (60 * 60)
+#define FLASH_TAIL_SECONDS (15 * 60)
+
+class Alarm
+{
+public:
+  bool Enabled;
+  uint8_t Hour;
+  uint8_t Minute;
+  uint8_t Second;
+  uint8_t Duration;
+  uint8_t RepeatDays;
+  bool EnabledForDay(uint8_t day) { return 1 & (RepeatDays >> (day > 6 ? 6 : day)); }
+  bool SingleShot() { return RepeatDays == 0; }
+
+  // minimum sunrise is 1 hour, flash if less
+  bool Sunrise() { return Duration >= 4; }
+  // seconds into the day the alarm should wake
+  uint32_t WakeTime() { return Hour * 3600UL + Minute * 60UL + Second; }
+  // seconds the alarm starts before WakeTime, so the sunrise peaks on the wake time
+  uint32_t Lead() { return Sunrise() ? SUNRISE_SECONDS : 0; }
+  // seconds from start to end; sunrise alarms keep at least a flashing tail after waking
+  uint32_t Length()
+  {
+    const uint32_t duration = Duration == 0 ? 5 * 60 : Duration * 15 * 60;
+    if (!Sunrise())
+      return duration;
+    const uint32_t tail = duration - SUNRISE_SECONDS;
+    return SUNRISE_SECONDS + (tail < FLASH_TAIL_SECONDS ? FLASH_TAIL_SECONDS : tail);
+  }
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+  AlarmScheduler.cpp - Deadline based alarm scheduler.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "AlarmScheduler.h"
+
+AlarmScheduler::AlarmScheduler(Alarm *alarms, uint8_t count, TimeZone &zone)
+    : _zone(zone)
+{
+  _alarms = alarms;
+  _count = count > ALARM_CAPACITY ? ALARM_CAPACITY : count;
+}
+
+void AlarmScheduler::invalidate()
+{
+  _dirty = true;
+}
+
+bool AlarmScheduler::poll(uint32_t now, uint8_t &index, uint32_t &epoch)
+{
+  if (now < SCHEDULER_EPOCH_VALID)
+    return false;
+
+  // first valid time, or the clock jumped further than a stall would explain
+  if (_lastPoll == 0 || now > _lastPoll + SCHEDULER_CATCHUP_WINDOW || now + SCHEDULER_CATCHUP_WINDOW < _lastPoll)
+  {
+    _catchUp = true;
+    _dirty = true;
+  }
+  _lastPoll = now;
+
+  if (_dirty)
+  {
+    rebuild(now);
+    _dirty = false;
+    _catchUp = false;
+  }
+
+  if (_queueLength == 0 || _queue[0].Epoch > now)
+  {
+    if (now > _covered)
+    {
+      _covered = now;
+      _coveredIndex = ALARM_CAPACITY;
+    }
+    return false;
+  }
+
+  index = _queue[0].Index;
+  epoch = _queue[0].Epoch;
+
+  popHead();
+  if (!_alarms[index].SingleShot())
+    insert(nextFire(_alarms[index], epoch), index);
+
+  _covered = epoch;
+  _coveredIndex = index;
+  return true;
+}
+
+uint32_t AlarmScheduler::nextEpoch()
+{
+  return _queueLength ? _queue[0].Epoch : 0;
+}
+
+uint8_t AlarmScheduler::nextIndex()
+{
+  return _queueLength ? _queue[0].Index : ALARM_CAPACITY;
+}
+
+uint8_t AlarmScheduler::queued()
+{
+  return _queueLength;
+}
+
+uint32_t AlarmScheduler::nextFire(Alarm &alarm, uint32_t after)
+{
+  const uint32_t timeOfDay = alarm.WakeTime();
+  const uint32_t lead = alarm.Lead();
+  const uint32_t day = _zone.toLocal(after) / SECONDS_PER_DAY;
+
+  for (uint32_t d = day; d <= day + 8; d++)
+  {
+    // repeat days apply to the local day of the wake time, not the day the sunrise starts
+    const uint32_t wake = d * SECONDS_PER_DAY + timeOfDay;
+    const uint32_t start = _zone.toUtc(wake) - lead;
+    if (start <= after)
+      continue;
+
+    if (alarm.SingleShot() || alarm.EnabledForDay(weekday(wake)))
+      return start;
+  }
+
+  return 0;
+}
+
+uint8_t AlarmScheduler::weekday(uint32_t epoch)
+{
+  return ((epoch / SECONDS_PER_DAY) + 4) % 7; // 1970-01-01 was a thursday, 0 = sunday
+}
+
+void AlarmScheduler::rebuild(uint32_t now)
+{
+  _queueLength = 0;
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (!_alarms[i].Enabled)
+      continue;
+
+    // after a boot or a forward jump, any start whose alarm would still be running is owed;
+    // a backward jump never returns a start again
+    const uint32_t running = now - _alarms[i].Length();
+    uint32_t epoch;
+    if (_catchUp && running >= _covered)
+      epoch = nextFire(_alarms[i], running);
+    else
+    {
+      // everything not yet returned is still owed, so a stall or an edit mid catch-up can't skip an alarm;
+      // equal epochs are returned in index order
+      epoch = nextFire(_alarms[i], _covered - 1);
+      if (epoch == _covered && i <= _coveredIndex)
+        epoch = nextFire(_alarms[i], _covered);
+    }
+
+    if (epoch)
+      insert(epoch, i);
+  }
+}
+
+void AlarmScheduler::insert(uint32_t epoch, uint8_t index)
+{
+  if (_queueLength >= ALARM_CAPACITY)
+    return;
+
+  uint8_t pos = _queueLength++;
+  while (pos > 0 && _queue[pos - 1].Epoch > epoch)
+  {
+    _queue[pos] = _queue[pos - 1];
+    pos--;
+  }
+
+  _queue[pos].Epoch = epoch;
+  _queue[pos].Index = index;
+}
+
+void AlarmScheduler::popHead()
+{
+  for (uint8_t i = 1; i < _queueLength; i++)
+    _queue[i - 1] = _queue[i];
+  _queueLength--;
+}
@@ -0,0 +1,60 @@
+/*
+  AlarmScheduler.h - Deadline based alarm scheduler.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _AlarmScheduler_h
+#define _AlarmScheduler_h
+
+#include "Arduino.h"
+#include "Alarm.h"
+#include "TimeZone.h"
+
+#define SECONDS_PER_DAY 86400UL
+#define SCHEDULER_CATCHUP_WINDOW (10 * 60) // seconds, larger gaps are treated as a clock jump
+#define SCHEDULER_EPOCH_VALID 1546300800UL // 2019-01-01, anything earlier is an unsynced clock
+
+struct ScheduledAlarm
+{
+  uint32_t Epoch;
+  uint8_t Index;
+};
+
+// Keeps the next start time of every enabled alarm in a queue sorted by
+// epoch (utc, seconds). Alarm times are local wall time and are converted
+// through the time zone when scheduled, so DST changes never look like a
+// clock jump. Start times include the alarm's Lead(). The queue is only rebuilt when the alarms
+// change, polling is a comparison against the head of the queue. On the first poll and after a
+// clock jump, alarms whose start is less than their Length() ago are returned late.
+class AlarmScheduler
+{
+public:
+  AlarmScheduler(Alarm *alarms, uint8_t count, TimeZone &zone);
+
+  void invalidate();
+  bool poll(uint32_t now, uint8_t &index, uint32_t &epoch);
+
+  uint32_t nextEpoch();
+  uint8_t nextIndex();
+  uint8_t queued();
+
+  uint32_t nextFire(Alarm &alarm, uint32_t after);
+  static uint8_t weekday(uint32_t epoch);
+
+private:
+  void rebuild(uint32_t now);
+  void insert(uint32_t epoch, uint8_t index);
+  void popHead();
+
+  Alarm *_alarms;
+  uint8_t _count;
+  TimeZone &_zone;
+  ScheduledAlarm _queue[ALARM_CAPACITY];
+  uint8_t _queueLength = 0;
+  uint32_t _lastPoll = 0;
+  uint32_t _covered = 0;                    // everything due by here has been returned,
+  uint8_t _coveredIndex = ALARM_CAPACITY;   // except ties after this index
+  bool _catchUp = false;
+  bool _dirty = true;
+};
+
+#endif
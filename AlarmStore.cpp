@@ -0,0 +1,264 @@
+/*
+  AlarmStore.cpp - Binary alarm persistence with A/B snapshots and a delta journal.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "AlarmStore.h"
+
+AlarmStore::AlarmStore(Alarm *alarms, uint8_t count)
+{
+  _alarms = alarms;
+  _count = count > ALARM_CAPACITY ? ALARM_CAPACITY : count;
+  memset(_shadow, 0, sizeof(_shadow));
+}
+
+bool AlarmStore::load()
+{
+  uint32_t genA = 0, genB = 0;
+  const bool validA = readSnapshot(ALARMSTORE_SLOT_A, genA, false);
+  const bool validB = readSnapshot(ALARMSTORE_SLOT_B, genB, false);
+
+  if (!validA && !validB)
+  {
+    _loaded = false;
+    _generation = 0;
+    _journalLength = 0;
+    return false;
+  }
+
+  const bool useA = validA && (!validB || genA > genB);
+  readSnapshot(useA ? ALARMSTORE_SLOT_A : ALARMSTORE_SLOT_B, _generation, true);
+  _journalLength = replayJournal();
+
+  for (uint8_t i = 0; i < _count; i++)
+    encode(_alarms[i], _shadow[i]);
+
+  _loaded = true;
+  return true;
+}
+
+bool AlarmStore::commit()
+{
+  if (!_loaded)
+    return commitSnapshot();
+
+  uint8_t changed = 0;
+  uint8_t record[ALARMSTORE_RECORD_SIZE];
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    encode(_alarms[i], record);
+    if (memcmp(record, _shadow[i], ALARMSTORE_RECORD_SIZE))
+      changed++;
+  }
+
+  if (!changed)
+    return true;
+
+  // rewriting everything is cheaper than journaling most of the table
+  if (changed > _count / 2 || _journalLength + changed > ALARMSTORE_JOURNAL_LIMIT)
+    return commitSnapshot();
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    encode(_alarms[i], record);
+    if (memcmp(record, _shadow[i], ALARMSTORE_RECORD_SIZE) == 0)
+      continue;
+
+    if (!appendJournal(i))
+      return commitSnapshot();
+  }
+
+  return true;
+}
+
+bool AlarmStore::commitSnapshot()
+{
+  const uint32_t generation = _generation + 1;
+  const char *name = generation & 1 ? ALARMSTORE_SLOT_A : ALARMSTORE_SLOT_B;
+
+  uint8_t header[ALARMSTORE_HEADER_SIZE];
+  putU32(header, ALARMSTORE_MAGIC);
+  header[4] = ALARMSTORE_VERSION;
+  header[5] = _count;
+  header[6] = ALARMSTORE_RECORD_SIZE;
+  header[7] = 0;
+  putU32(header + 8, generation);
+
+  uint8_t records[ALARM_CAPACITY][ALARMSTORE_RECORD_SIZE];
+  for (uint8_t i = 0; i < _count; i++)
+    encode(_alarms[i], records[i]);
+
+  uint8_t crc[4];
+  putU32(crc, Checksum::crc32((uint8_t *)records, _count * ALARMSTORE_RECORD_SIZE, Checksum::crc32(header, ALARMSTORE_HEADER_SIZE)));
+
+  auto f = SPIFFS.open(name, "w");
+  if (!f)
+    return false;
+
+  size_t written = f.write(header, ALARMSTORE_HEADER_SIZE);
+  written += f.write((uint8_t *)records, _count * ALARMSTORE_RECORD_SIZE);
+  written += f.write(crc, 4);
+  f.close();
+
+  if (written != ALARMSTORE_HEADER_SIZE + _count * ALARMSTORE_RECORD_SIZE + 4)
+    return false;
+
+  // the new snapshot is complete, entries against the old generation are now dead weight
+  SPIFFS.remove(ALARMSTORE_JOURNAL);
+
+  memcpy(_shadow, records, sizeof(records));
+  _generation = generation;
+  _journalLength = 0;
+  _loaded = true;
+  return true;
+}
+
+void AlarmStore::reset()
+{
+  _loaded = false;
+  _journalLength = 0;
+}
+
+uint32_t AlarmStore::generation()
+{
+  return _generation;
+}
+
+uint8_t AlarmStore::journalLength()
+{
+  return _journalLength;
+}
+
+bool AlarmStore::readSnapshot(const char *name, uint32_t &generation, bool apply)
+{
+  if (!SPIFFS.exists(name))
+    return false;
+
+  auto f = SPIFFS.open(name, "r");
+  if (!f)
+    return false;
+
+  uint8_t header[ALARMSTORE_HEADER_SIZE];
+  if (f.read(header, ALARMSTORE_HEADER_SIZE) != ALARMSTORE_HEADER_SIZE
+    || getU32(header) != ALARMSTORE_MAGIC
+    || header[4] != ALARMSTORE_VERSION
+    || header[6] < ALARMSTORE_RECORD_SIZE
+    || f.size() != ALARMSTORE_HEADER_SIZE + (size_t)header[5] * header[6] + 4)
+  {
+    f.close();
+    return false;
+  }
+
+  // verify before touching the alarms, records are read twice rather than buffered
+  generation = getU32(header + 8);
+  uint32_t crc = Checksum::crc32(header, ALARMSTORE_HEADER_SIZE);
+  uint8_t record[255];
+  for (uint8_t i = 0; i < header[5]; i++)
+  {
+    f.read(record, header[6]);
+    crc = Checksum::crc32(record, header[6], crc);
+  }
+  uint8_t stored[4];
+  f.read(stored, 4);
+  if (getU32(stored) != crc || !apply)
+  {
+    f.close();
+    return getU32(stored) == crc;
+  }
+
+  f.seek(ALARMSTORE_HEADER_SIZE, SeekSet);
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (i < header[5])
+    {
+      f.read(record, header[6]);
+      decode(record, _alarms[i]);
+    }
+    else
+      _alarms[i] = Alarm();
+  }
+  f.close();
+
+  return true;
+}
+
+uint8_t AlarmStore::replayJournal()
+{
+  if (!SPIFFS.exists(ALARMSTORE_JOURNAL))
+    return 0;
+
+  auto f = SPIFFS.open(ALARMSTORE_JOURNAL, "r");
+  if (!f)
+    return 0;
+
+  uint8_t count = 0;
+  uint8_t entry[ALARMSTORE_ENTRY_SIZE];
+  while (f.read(entry, ALARMSTORE_ENTRY_SIZE) == ALARMSTORE_ENTRY_SIZE)
+  {
+    if (getU32(entry + 12) != Checksum::crc32(entry, 12) || getU32(entry) != _generation)
+      continue;
+
+    if (entry[4] < _count)
+      decode(entry + 5, _alarms[entry[4]]);
+    count++;
+  }
+  f.close();
+
+  return count;
+}
+
+bool AlarmStore::appendJournal(uint8_t index)
+{
+  uint8_t entry[ALARMSTORE_ENTRY_SIZE];
+  putU32(entry, _generation);
+  entry[4] = index;
+  encode(_alarms[index], entry + 5);
+  entry[11] = 0;
+  putU32(entry + 12, Checksum::crc32(entry, 12));
+
+  auto f = SPIFFS.open(ALARMSTORE_JOURNAL, "a");
+  if (!f)
+    return false;
+
+  size_t written = f.write(entry, ALARMSTORE_ENTRY_SIZE);
+  f.close();
+
+  if (written != ALARMSTORE_ENTRY_SIZE)
+    return false;
+
+  memcpy(_shadow[index], entry + 5, ALARMSTORE_RECORD_SIZE);
+  _journalLength++;
+  return true;
+}
+
+void AlarmStore::encode(Alarm &alarm, uint8_t *record)
+{
+  record[0] = alarm.Enabled ? 1 : 0;
+  record[1] = alarm.Hour;
+  record[2] = alarm.Minute;
+  record[3] = alarm.Second;
+  record[4] = alarm.Duration;
+  record[5] = alarm.RepeatDays;
+}
+
+void AlarmStore::decode(const uint8_t *record, Alarm &alarm)
+{
+  alarm.Enabled = record[0] != 0;
+  alarm.Hour = record[1];
+  alarm.Minute = record[2];
+  alarm.Second = record[3];
+  alarm.Duration = record[4];
+  alarm.RepeatDays = record[5];
+}
+
+void AlarmStore::putU32(uint8_t *dst, uint32_t value)
+{
+  dst[0] = value;
+  dst[1] = value >> 8;
+  dst[2] = value >> 16;
+  dst[3] = value >> 24;
+}
+
+uint32_t AlarmStore::getU32(const uint8_t *src)
+{
+  return src[0] | (src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
@@ -0,0 +1,66 @@
+/*
+  AlarmStore.h - Binary alarm persistence with A/B snapshots and a delta journal.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _AlarmStore_h
+#define _AlarmStore_h
+
+#include "Arduino.h"
+#include <FS.h>
+#include "Alarm.h"
+#include "Checksum.h"
+
+#define ALARMSTORE_SLOT_A "sys_alarms.a"
+#define ALARMSTORE_SLOT_B "sys_alarms.b"
+#define ALARMSTORE_JOURNAL "sys_alarms.log"
+
+#define ALARMSTORE_MAGIC 0x4D524C41 // "ALRM"
+#define ALARMSTORE_VERSION 1
+#define ALARMSTORE_RECORD_SIZE 6
+#define ALARMSTORE_HEADER_SIZE 12
+#define ALARMSTORE_ENTRY_SIZE 16
+#define ALARMSTORE_JOURNAL_LIMIT 32
+
+// Snapshot (slot A or B):
+//   magic u32, version u8, capacity u8, record size u8, reserved u8, generation u32,
+//   capacity * record, crc32 u32 over everything before it.
+// Journal entry:
+//   generation u32, index u8, record, reserved u8, crc32 u32 over the first 12 bytes.
+//
+// A snapshot is always written to the slot that does not hold the current
+// generation, so a torn write leaves the previous snapshot intact. Journal
+// entries only apply to the snapshot generation they were written against,
+// torn entries fail their crc and are ignored.
+class AlarmStore
+{
+public:
+  AlarmStore(Alarm *alarms, uint8_t count);
+
+  bool load();
+  bool commit();
+  bool commitSnapshot();
+  void reset();
+
+  uint32_t generation();
+  uint8_t journalLength();
+
+  static void encode(Alarm &alarm, uint8_t *record);
+  static void decode(const uint8_t *record, Alarm &alarm);
+
+private:
+  bool readSnapshot(const char *name, uint32_t &generation, bool apply);
+  uint8_t replayJournal();
+  bool appendJournal(uint8_t index);
+
+  static void putU32(uint8_t *dst, uint32_t value);
+  static uint32_t getU32(const uint8_t *src);
+
+  Alarm *_alarms;
+  uint8_t _count;
+  uint8_t _shadow[ALARM_CAPACITY][ALARMSTORE_RECORD_SIZE];
+  uint32_t _generation = 0;
+  uint8_t _journalLength = 0;
+  bool _loaded = false;
+};
+
+#endif
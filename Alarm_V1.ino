@@ -3,16 +3,28 @@
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
-#include <NTPClient.h>
 #include <FS.h>
 #include <ArduinoJson.h>
 
+#include "AlarmScheduler.h"
+#include "AlarmStore.h"
+#include "Button.h"
+#include "EventBus.h"
 #include "Font_11x15.h"
 #include "Font_5x7.h"
 #include "Font_8x8_Icons.h"
+#include "HeapMonitor.h"
+#include "Log.h"
+#include "LedCompositor.h"
+#include "LedStrips.h"
+#include "LoopProfiler.h"
 #include "SSD1306_SWI2C.h"
 #include "SSD1306_Utils.h"
+#include "SunriseSync.h"
+#include "SystemClock.h"
+#include "TimeZone.h"
 #include "WebServer.h"
+#include "WifiConnection.h"
 
 #define P_SDA 5
 #define P_SCL 4
@@ -20,39 +32,73 @@
 #define P_BTN 13
 
 #define P_SWI 15
-#define BP_SWI 0x00008000
 
-#define GPIO_ON_ADDR 0x60000304
-#define GPIO_OFF_ADDR 0x60000308
-
-#define ALARM_FILE_NAME "sys_alarms.json"
-#define ALARM_COUNT 7
+#define ALARM_LEGACY_FILE_NAME "sys_alarms.json"
+#define TIME_CONFIG_FILE_NAME "sys_time.json"
+#define TIME_CONFIG_TEMP_FILE_NAME "sys_time.tmp"
 #define NUM_LEDS 72
 #define NUM_LED_COLORS (NUM_LEDS * 4)
+#define LAYER_COLOURCYCLE 0
+#define LAYER_TORCH 1
+#define LAYER_API 2
+#define LAYER_ALARM 3 // on top, nothing left enabled may hide an alarm
 #define DISPLAY_AUTOOFFDELAY 30000
-#define SUNRISE_DURATION (60 * 60 * 1000 / INTERVAL_ALARMVISUALS)
-#define SUNRISE_TICKSPERCOLOUR (SUNRISE_DURATION / 30)
+#define SUNRISE_DURATION (SUNRISE_SECONDS * 1000UL)
+#define SUNRISE_MSPERCOLOUR (SUNRISE_DURATION / 30)
 #define FLASH_ONTICKS 1
 #define FLASH_OFFTICKS 2
 #define FLASH_FLASHES 2
 #define FLASH_PERIODTICKS 10
-
-#define INTERVAL_OTA 1000
-#define INTERVAL_CONNCHECK 5000
+#define BUTTON_ALARMCANCEL_MS 2500
+#define OTA_REDRAW_MS 200
+#define STATUS_ROWS 8
+#define STATUS_X 12          // after the wifi icon
+#define STATUS_END 99        // the webserver icons start at 100
+#define STATUS_WIDTH (STATUS_END - STATUS_X + 1)
+#define STATUS_SCROLL_GAP 18 // blank columns before the text repeats
+#define OTA_BAR_Y 16
+#define OTA_BAR_HEIGHT 6
+#define OTA_PERCENT_X 60
+
+#define INTERVAL_OTA 100
+#define INTERVAL_CONNCHECK 100
 #define INTERVAL_DISPLAYREFRESH 20
 #define INTERVAL_PIXELBLINK 250
-#define INTERVAL_TIMEUPDATE 20000
+#define INTERVAL_TIMEUPDATE 1
 #define INTERVAL_TIMEDRAW 500
-#define INTERVAL_ALARMCHECK 10000
+#define INTERVAL_ALARMCHECK 1000
 #define INTERVAL_ALARMVISUALS 100
 #define INTERVAL_WEBSERVER 25
 #define INTERVAL_LEDUPDATE 32
 #define INTERVAL_COLOURCYCLE 1
-#define INTERVAL_BUTTONCHECK 100
+#define INTERVAL_BUTTONCHECK 10
+#define INTERVAL_HEAPCHECK 1000
+#define INTERVAL_SUNRISESYNC 100
+
+// lowest id leads the sunrise, override to run several host builds side by side
+#ifndef SYNC_UNIT_ID
+#define SYNC_UNIT_ID ESP.getChipId()
+#endif
 
 #define CURRENT_LIMIT_500
 //define CURRENT_LIMIT_2500
 
+// per-task timing served at /api/debug/profile, comment out for release builds
+#define PROFILE_LOOP
+
+#ifdef PROFILE_LOOP
+#define PROFILE(task, late, call)                             \
+  do                                                          \
+  {                                                           \
+    const uint32_t _late = (late)*1000;                       \
+    const uint32_t _start = ESP.getCycleCount();              \
+    call;                                                     \
+    profiler.record(task, ESP.getCycleCount() - _start, _late); \
+  } while (0)
+#else
+#define PROFILE(task, late, call) call
+#endif
+
 // create a WifiPassword.h file that defines WIFI_PASSWORD & declares ssid & pass
 #if __has_include("WifiPassword.h")
 #include "WifiPassword.h"
@@ -62,43 +108,130 @@ const char *ssid = "";
 const char *pass = "";
 #endif
 
-const char *ntpServer = "192.168.1.1";
-const long utcOffsetInSeconds = 7200L;
+// create an OtaSigningKey.h file that defines OTA_SIGNED & declares otaSigningKey (PEM public key) to only accept signed images
+#if __has_include("OtaSigningKey.h")
+#include "OtaSigningKey.h"
+#include <BearSSLHelpers.h>
+#include <Updater.h>
+#endif
 
-extern "C" void ICACHE_RAM_ATTR swi_write_ext(uint8_t *data, uint16_t len, uint8_t repeat);
+const char *ntpServer = "192.168.1.1";
+const char *defaultTimeZone = "SAST-2";
 
+SSD1306_TWI displayBus;
 SSD1306 *screen;
 Font_5x7 *small_font = new Font_5x7();
 Font_11x15 *medium_font = new Font_11x15();
 Font_8x8_Icons *icon_font = new Font_8x8_Icons();
+WifiConnection wifi;
+Button button(P_BTN);
+HeapMonitor heap;
+#ifdef PROFILE_LOOP
+LoopProfiler profiler;
+#endif
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, ntpServer, utcOffsetInSeconds);
+TimeZone timeZone;
+SystemClock systemClock(ntpUDP, ntpServer, timeZone);
+WiFiUDP syncUDP;
+SunriseSync sunriseSync(syncUDP);
+EventBus events;
 WiFiServer server(80);
 WebServer webserver(&server);
 
 //G, R, B, W
 uint8_t led_colours[NUM_LED_COLORS];
+LedCompositor compositor(led_colours, NUM_LED_COLORS);
+
+// strips take consecutive runs of led_colours, in this order; add one per
+// data pin, sent in parallel
+const LedStrip ledStrips[] = {
+  { P_SWI, NUM_LEDS },
+};
+
+//LED Pattern
+//   1-18 inside
+//  19-36 outside
+//  37-54 inside
+//  55-72 outside
+const LedSegment ledSegments[] = {
+  { 18, LedZone::Inside },
+  { 18, LedZone::Outside },
+  { 18, LedZone::Inside },
+  { 18, LedZone::Outside },
+};
+LedStrips strips(ledStrips, sizeof(ledStrips) / sizeof(ledStrips[0]), ledSegments, sizeof(ledSegments) / sizeof(ledSegments[0]));
 
 bool alarming = false;
+bool otaActive = false;
 bool activityPixelState = false;
-volatile bool buttonPressed = false;
+char statusText[SSD1306_UTILS_PRINTF_BUFFER];
+uint8_t statusTextWidth = 0; // pixels, scrolls when wider than STATUS_WIDTH
+uint8_t statusOffset = 0;
 bool colorCycleEnabled = false;
 bool displayAutoOff = false;
 bool displayOn = true;
 bool displayRefreshNeeded = false;
+bool flashOn = false;
 bool sunriseComplete = false;
 bool timeUpdateSuccess = false;
-uint32_t alarming_remainder = 0;
-uint8_t alarming_alarm = ALARM_COUNT;
-uint8_t buttonPressedCount = 0;
+uint8_t nightStart = 21;
+uint8_t nightEnd = 7;
+uint32_t alarming_started = 0;
+uint32_t alarming_epoch = 0; // utc the alarm was due to start, shared by units running the same alarm
+uint32_t alarming_length = 0;
+uint8_t alarming_alarm = ALARM_CAPACITY;
+uint8_t buttonHeldTicks = 0;
 uint16_t colourCycle_currentIndex = 0;
-int32_t connectionRetryCount = 1;
 uint32_t displayLastActivity = 0;
 uint8_t displayResyncCounter = 0;
-uint8_t flashCounter = 0;
-uint32_t sunriseRemaining = 0;
 uint8_t torching = 0;
 
+enum class ButtonAction : uint8_t
+{
+  None,
+  TorchStep,
+  TorchOff,
+  AlarmCancel
+};
+
+struct GestureBinding
+{
+  ButtonEvent Event;
+  bool Alarming;
+  uint32_t MinDuration;
+  ButtonAction Action;
+};
+
+// profiler ids, in the order they are registered in setup_profiler()
+enum LoopTask : uint8_t
+{
+  TASK_CONNCHECK,
+  TASK_PIXELBLINK,
+  TASK_OTA,
+  TASK_COLOURCYCLE,
+  TASK_TIMEUPDATE,
+  TASK_TIMEDRAW,
+  TASK_ALARMCHECK,
+  TASK_ALARMVISUALS,
+  TASK_WEBSERVER,
+  TASK_LEDUPDATE,
+  TASK_BUTTONCHECK,
+  TASK_DISPLAYREFRESH,
+  TASK_HEAPCHECK,
+  TASK_SUNRISESYNC,
+  TASK_EVENTS,
+  TASK_LOGDRAIN
+};
+
+// first match wins
+const GestureBinding gestureBindings[] = {
+    {ButtonEvent::HoldRepeat, true, BUTTON_ALARMCANCEL_MS, ButtonAction::AlarmCancel},
+    {ButtonEvent::Click, false, 0, ButtonAction::TorchStep},
+    {ButtonEvent::LongPress, false, 0, ButtonAction::TorchStep},
+    {ButtonEvent::HoldRepeat, false, 0, ButtonAction::TorchStep},
+    {ButtonEvent::DoubleClick, false, 0, ButtonAction::TorchOff},
+};
+
 uint32_t last_OTA = 0;
 uint32_t last_ConnCheck = 0;
 uint32_t last_displayRefresh = 0;
@@ -111,23 +244,18 @@ uint32_t last_webServerUpdate = 0;
 uint32_t last_ledUpdate = 0;
 uint32_t last_colorCycle = 0;
 uint32_t last_buttonCheck = 0;
+uint32_t last_heapCheck = 0;
+uint32_t last_sunriseSync = 0;
 
 ApiMethod *GetMethods;
 ApiMethod *PostMethods;
+ApiMethod *PutMethods;
+ApiMethod *PatchMethods;
+ApiMethod *DeleteMethods;
 
-class Alarm
-{
-public:
-  bool Enabled;
-  uint8_t Hour;
-  uint8_t Minute;
-  uint8_t Duration;
-  uint8_t RepeatDays;
-  bool EnabledForDay(uint8_t day) { return 1 & (RepeatDays >> (day > 6 ? 6 : day)); }
-  bool SingleShot() { return RepeatDays == 0; }
-};
-
-Alarm *alarms = new Alarm[ALARM_COUNT];
+Alarm *alarms = new Alarm[ALARM_CAPACITY]();
+AlarmScheduler scheduler(alarms, ALARM_CAPACITY, timeZone);
+AlarmStore alarmStore(alarms, ALARM_CAPACITY);
 
 // G,R,B,W
 #if defined(CURRENT_LIMIT_500)
@@ -204,128 +332,224 @@ void setup()
 {
   Serial.begin(115200);
   Serial.println();
-  Serial.println("Booting");
+  LOG_INFO("Booting");
 
   pinMode(P_LED, OUTPUT);
   digitalWrite(P_LED, HIGH);
-  pinMode(P_SWI, OUTPUT);
-  WRITE_PERI_REG(GPIO_OFF_ADDR, BP_SWI);
-
-  pinMode(P_BTN, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(P_BTN), isr_buttonStateChange, CHANGE);
+  strips.begin(NUM_LEDS);
 
-  screen = new SSD1306(P_SDA, P_SCL);
-  screen->clear_buffer();
-  SSD1306_Utils::write_string(screen, 0, 0, small_font, "Booting");
-  screen->refresh();
+  compositor.set_mode(LAYER_COLOURCYCLE, BlendMode::Replace);
+  compositor.set_mode(LAYER_TORCH, BlendMode::Max);
+  compositor.set_mode(LAYER_API, BlendMode::Replace);
+  compositor.set_mode(LAYER_ALARM, BlendMode::Replace);
 
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, pass);
+  button.begin(isr_buttonStateChange);
+  setup_events();
 
-  Serial.println("Connecting Wifi");
+  displayBus.init(P_SDA, P_SCL);
+  screen = new SSD1306(displayBus);
   screen->clear_buffer();
-  SSD1306_Utils::write_string(screen, 0, 0, small_font, "Connecting");
+  SSD1306_Utils::write_string(screen, 0, 0, small_font, "Booting");
   screen->refresh();
 
-  while (WiFi.waitForConnectResult() != WL_CONNECTED)
+  if (SPIFFS.begin())
   {
-    Serial.println("Connection Failed! Rebooting...");
-    screen->clear_buffer();
-    SSD1306_Utils::write_string(screen, 0, 0, small_font, "Connection Failed!");
-    SSD1306_Utils::write_string(screen, 0, 12, small_font, "Rebooting...");
-    screen->refresh();
-
-    delay(5000);
-    ESP.restart();
+    LOG_INFO("FS init OK");
+  }
+  else
+  {
+    LOG_WARN("FS init failed, formatting");
+    SPIFFS.format();
+    if (SPIFFS.begin())
+      LOG_INFO("FS init OK");
+    else
+      LOG_ERROR("FS init failed");
   }
 
-  Serial.print("Connected, IP Address is: ");
-  Serial.println(WiFi.localIP());
+  // alarms run from the restored clock, the network catches up in the background
+  setup_time();
+  setup_alarms();
 
-  Serial.print("Provisioning OTA...");
-  setup_ota();
-  Serial.println(" done.");
+  LOG_INFO("Connecting Wifi");
+  wifi.begin(ssid, pass);
 
-  Serial.print("Setting up Webserver Callbacks...");
+  setup_ota();
   setup_webserver();
-  Serial.println(" done.");
+  webserver.IndexFiles();
 
-  timeClient.begin();
-  ntpUDP.setTimeout(75);
+  systemClock.begin();
+  sunriseSync.begin(SYNC_UNIT_ID);
   server.begin();
 
-  Serial.print("FS init...");
-  if (SPIFFS.begin())
-  {
-    Serial.println(" OK");
-  }
-  else
+  setup_profiler();
+
+  LOG_INFO("Booted");
+}
+void setup_time()
+{
+  timeZone.parse(defaultTimeZone);
+
+  const char *name = SPIFFS.exists(TIME_CONFIG_FILE_NAME) ? TIME_CONFIG_FILE_NAME : TIME_CONFIG_TEMP_FILE_NAME;
+  if (SPIFFS.exists(name))
   {
-    Serial.print(" failed, formatting...");
-    SPIFFS.format();
-    SPIFFS.begin() ? Serial.println(" OK") : Serial.println(" failed.");
+    auto f = SPIFFS.open(name, "r");
+    String json = f.readString();
+    f.close();
+
+    if (!deserializeTimeConfig(json))
+      LOG_WARN("FS: Ignoring invalid time config");
   }
 
-  setup_alarms();
+  LOG_INFO("Time zone: %s", timeZone.spec());
 
-  Serial.println("Booted.\r\n");
+  if (systemClock.restore())
+    LOG_INFO("Clock restored from %s: %llu", systemClock.source() == ClockSource::Rtc ? "rtc" : "flash", systemClock.local().Utc);
 }
 void setup_alarms()
 {
-  if (SPIFFS.exists(ALARM_FILE_NAME))
+  if (alarmStore.load())
+  {
+    LOG_INFO("Alarms loaded, generation %d, %d journal entries", alarmStore.generation(), alarmStore.journalLength());
+  }
+  else if (SPIFFS.exists(ALARM_LEGACY_FILE_NAME))
   {
-    auto f = SPIFFS.open(ALARM_FILE_NAME, "r");
+    // one-off migration from the json file
+    auto f = SPIFFS.open(ALARM_LEGACY_FILE_NAME, "r");
     String json = f.readString();
     f.close();
-    deserializeAlarms(json);
+
+    // the file is only removed once its alarms are safely in the store
+    if (!deserializeLegacyAlarms(json))
+      LOG_ERROR("Alarms: %s unreadable, kept", ALARM_LEGACY_FILE_NAME);
+    else if (alarmStore.commitSnapshot())
+      SPIFFS.remove(ALARM_LEGACY_FILE_NAME);
   }
+  scheduler.invalidate();
+  events.publish(EventType::AlarmsChanged);
+}
+void setup_events()
+{
+  events.subscribe(EventType::AlarmStarted, on_alarmStarted);
+  events.subscribe(EventType::AlarmEnded, on_alarmEnded);
+  events.subscribe(EventType::TorchChanged, on_torchChanged);
+  events.subscribe(EventType::NetworkStateChanged, on_networkStateChanged);
+
+  events.subscribe(EventType::AlarmStarted, on_statusChanged);
+  events.subscribe(EventType::AlarmEnded, on_statusChanged);
+  events.subscribe(EventType::AlarmsChanged, on_statusChanged);
+  events.subscribe(EventType::TimeSynced, on_statusChanged);
+}
+void setup_profiler()
+{
+#ifdef PROFILE_LOOP
+  // budgets in us, rough ceilings for a healthy run; a full display frame is ~25ms of i2c
+  profiler.add("connectivity", 2000);
+  profiler.add("pixelBlink", 1000);
+  profiler.add("ota", 5000);
+  profiler.add("colourCycle", 2000);
+  profiler.add("timeUpdate", 2000);
+  profiler.add("timeDraw", 5000);
+  profiler.add("alarmCheck", 5000);
+  profiler.add("alarmVisuals", 2000);
+  profiler.add("webserver", 20000);
+  profiler.add("ledUpdate", 2000);
+  profiler.add("buttonCheck", 2000);
+  profiler.add("displayRefresh", 30000);
+  profiler.add("heapCheck", 2000);
+  profiler.add("sunriseSync", 2000);
+  profiler.add("events", 5000);
+  profiler.add("logDrain", 1000);
+  profiler.reset();
+#endif
 }
 void setup_ota()
 {
-  static ulong last_OTA_ScreenRefresh = 0;
+  static uint32_t last_OTA_ScreenRefresh = 0;
+  static uint8_t otaPercent = 0;
+  static uint8_t otaBarEnd = 0;
+
+#ifdef OTA_SIGNED
+  // the sha-256 of the image is checked against its signature in Update.end(), before the reboot
+  static BearSSL::PublicKey otaKey(otaSigningKey);
+  static BearSSL::HashSHA256 otaHash;
+  static BearSSL::SigningVerifier otaVerifier(&otaKey);
+  Update.installSignature(&otaHash, &otaVerifier);
+#else
+  // unsigned builds have no sha-256 to check against, only the md5 espota sends with the invitation,
+  // which catches a corrupted transfer but not a deliberately altered image
+  LOG_WARN("OTA accepts unsigned images");
+#endif
+
   ArduinoOTA.onStart([]() {
-    Serial.println("OTA Start");
+    LOG_INFO("OTA Start");
+    otaActive = true;
+    otaPercent = 0;
+    otaBarEnd = 0;
+    last_OTA_ScreenRefresh = millis();
+
+    // one full frame, progress after this only pushes the columns that change
+    screen->clear_buffer();
+    SSD1306_Utils::write_string(screen, 0, 0, small_font, "Updating:");
+    SSD1306_Utils::write_string(screen, OTA_PERCENT_X, 0, small_font, "0%");
+    screen->refresh();
   });
 
   ArduinoOTA.onEnd([]() {
-    Serial.println("\nOTA End");
+    LOG_INFO("OTA End");
+    Log::flush(Serial); // the restart follows
     screen->clear_buffer();
     SSD1306_Utils::write_string(screen, 0, 0, small_font, "Applying Update...");
     screen->refresh();
   });
 
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-    Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+    // handle() streams the whole image before returning, keep the leds and alarms going meanwhile
+    ota_keepalive();
 
-    if (millis() > last_OTA_ScreenRefresh + 200)
-    {
-      screen->clear_buffer();
-      SSD1306_Utils::write_string(screen, 0, 0, small_font, "Updating: " + String(progress / (total / 100)));
-      screen->refresh();
-      last_OTA_ScreenRefresh = millis();
-    }
+    const uint8_t percent = total ? (uint64_t)progress * 100 / total : 0;
+    if (percent == otaPercent || millis() - last_OTA_ScreenRefresh < OTA_REDRAW_MS)
+      return;
+
+    LOG_DEBUG("OTA progress: %u%%", percent);
+    otaPercent = percent;
+
+    SSD1306_Utils::write_printf(screen, OTA_PERCENT_X, 0, small_font, "%u%%  ", percent);
+    screen->refresh_columns(OTA_PERCENT_X, OTA_PERCENT_X + 23);
+
+    const uint8_t barEnd = percent * 127 / 100;
+    for (uint8_t x = otaBarEnd; x <= barEnd; x++)
+      for (uint8_t y = OTA_BAR_Y; y < OTA_BAR_Y + OTA_BAR_HEIGHT; y++)
+        screen->set_pixel(x, y, true);
+    screen->refresh_columns(otaBarEnd, barEnd);
+    otaBarEnd = barEnd;
+
+    last_OTA_ScreenRefresh = millis();
   });
 
   ArduinoOTA.onError([](ota_error_t error) {
-    Serial.printf("Error[%u]: ", error);
+    otaActive = false;
+    screen->clear_buffer();
+    status_icons();
 
     if (error == OTA_AUTH_ERROR)
-      Serial.println("Auth Failed");
+      LOG_WARN("OTA Error[%u]: Auth Failed", (unsigned)error);
     else if (error == OTA_BEGIN_ERROR)
-      Serial.println("Begin Failed");
+      LOG_WARN("OTA Error[%u]: Begin Failed", (unsigned)error);
     else if (error == OTA_CONNECT_ERROR)
-      Serial.println("Connect Failed");
+      LOG_WARN("OTA Error[%u]: Connect Failed", (unsigned)error);
     else if (error == OTA_RECEIVE_ERROR)
-      Serial.println("Receive Failed");
+      LOG_WARN("OTA Error[%u]: Receive Failed", (unsigned)error);
     else if (error == OTA_END_ERROR)
-      Serial.println("End Failed");
+      LOG_WARN("OTA Error[%u]: End Failed", (unsigned)error);
+    else
+      LOG_WARN("OTA Error[%u]", (unsigned)error);
   });
 
   ArduinoOTA.begin();
 }
 void setup_webserver()
 {
-  GetMethods = new ApiMethod[4];
+  GetMethods = new ApiMethod[9];
 
   GetMethods[0].Path = "admin/cycle";
   GetMethods[0].Callback = api_getColourCycle;
@@ -339,12 +563,27 @@ void setup_webserver()
   GetMethods[3].Path = "debug/state";
   GetMethods[3].Callback = api_getState;
 
-  webserver.SetGetHandlers(GetMethods, 4);
+  GetMethods[4].Path = "alarms/*";
+  GetMethods[4].Callback = api_getAlarm;
+
+  GetMethods[5].Path = "time";
+  GetMethods[5].Callback = api_getTime;
+
+  GetMethods[6].Path = "debug/heap";
+  GetMethods[6].Callback = api_getHeap;
+
+  GetMethods[7].Path = "debug/profile";
+  GetMethods[7].Callback = api_getProfile;
 
-  PostMethods = new ApiMethod[7];
+  GetMethods[8].Path = "debug/log";
+  GetMethods[8].Callback = api_getLog;
+
+  webserver.SetGetHandlers(GetMethods, 9);
+
+  PostMethods = new ApiMethod[8];
 
   PostMethods[0].Path = "alarms";
-  PostMethods[0].Callback = api_setAlarms;
+  PostMethods[0].Task = api_setAlarms;
 
   PostMethods[1].Path = "admin/cycle";
   PostMethods[1].Callback = api_toggleColourCycle;
@@ -356,7 +595,7 @@ void setup_webserver()
   PostMethods[3].Callback = api_setLeds;
 
   PostMethods[4].Path = "admin/format";
-  PostMethods[4].Callback = api_format;
+  PostMethods[4].Task = api_format;
 
   PostMethods[5].Path = "admin/testAlarmOn";
   PostMethods[5].Callback = api_testAlarmOn;
@@ -364,87 +603,182 @@ void setup_webserver()
   PostMethods[6].Path = "admin/testAlarmOff";
   PostMethods[6].Callback = api_testAlarmOff;
 
-  webserver.SetPostHandlers(PostMethods, 7);
+  PostMethods[7].Path = "time";
+  PostMethods[7].Callback = api_setTime;
+
+  webserver.SetPostHandlers(PostMethods, 8);
+
+  PutMethods = new ApiMethod[1];
+
+  PutMethods[0].Path = "alarms/*";
+  PutMethods[0].Callback = api_putAlarm;
+
+  webserver.SetPutHandlers(PutMethods, 1);
+
+  PatchMethods = new ApiMethod[1];
+
+  PatchMethods[0].Path = "alarms/*";
+  PatchMethods[0].Callback = api_patchAlarm;
+
+  webserver.SetPatchHandlers(PatchMethods, 1);
+
+  DeleteMethods = new ApiMethod[2];
+
+  DeleteMethods[0].Path = "alarms/*";
+  DeleteMethods[0].Callback = api_deleteAlarm;
+
+  DeleteMethods[1].Path = "debug/profile";
+  DeleteMethods[1].Callback = api_resetProfile;
+
+  webserver.SetDeleteHandlers(DeleteMethods, 2);
 }
 ICACHE_RAM_ATTR void isr_buttonStateChange()
 {
-  buttonPressed = !digitalRead(P_BTN);
+  button.edge();
 }
 
 void loop()
 {
   uint32_t now = millis();
 
+#ifdef PROFILE_LOOP
+  profiler.loopStart();
+#endif
+
   if (now - last_ConnCheck >= INTERVAL_CONNCHECK)
-    check_connectivity();
+    PROFILE(TASK_CONNCHECK, now - last_ConnCheck - INTERVAL_CONNCHECK, check_connectivity());
 
   if (now - last_pixelBlink >= INTERVAL_PIXELBLINK)
-    pixel_blink();
+    PROFILE(TASK_PIXELBLINK, now - last_pixelBlink - INTERVAL_PIXELBLINK, pixel_blink());
 
   if (now - last_OTA >= INTERVAL_OTA)
-    check_ota();
+    PROFILE(TASK_OTA, now - last_OTA - INTERVAL_OTA, check_ota());
 
   if (now - last_colorCycle >= INTERVAL_COLOURCYCLE)
-    colour_cycle();
+    PROFILE(TASK_COLOURCYCLE, now - last_colorCycle - INTERVAL_COLOURCYCLE, colour_cycle());
 
   if (now - last_timeUpdate >= INTERVAL_TIMEUPDATE)
-    time_update();
+    PROFILE(TASK_TIMEUPDATE, now - last_timeUpdate - INTERVAL_TIMEUPDATE, time_update());
 
   if (now - last_timeDraw >= INTERVAL_TIMEDRAW)
-    time_draw();
+    PROFILE(TASK_TIMEDRAW, now - last_timeDraw - INTERVAL_TIMEDRAW, time_draw());
 
   if (now - last_alarmCheck >= INTERVAL_ALARMCHECK)
-    check_alarms();
+    PROFILE(TASK_ALARMCHECK, now - last_alarmCheck - INTERVAL_ALARMCHECK, check_alarms());
 
   if (now - last_alarmVisuals >= INTERVAL_ALARMVISUALS)
-    alarm_visuals();
+    PROFILE(TASK_ALARMVISUALS, now - last_alarmVisuals - INTERVAL_ALARMVISUALS, alarm_visuals());
 
   if (now - last_webServerUpdate >= INTERVAL_WEBSERVER)
-    check_webserver();
+    PROFILE(TASK_WEBSERVER, now - last_webServerUpdate - INTERVAL_WEBSERVER, check_webserver());
 
   if (now - last_ledUpdate >= INTERVAL_LEDUPDATE)
-    led_update();
+    PROFILE(TASK_LEDUPDATE, now - last_ledUpdate - INTERVAL_LEDUPDATE, led_update());
 
   if (now - last_buttonCheck >= INTERVAL_BUTTONCHECK)
-    button_check();
+    PROFILE(TASK_BUTTONCHECK, now - last_buttonCheck - INTERVAL_BUTTONCHECK, button_check());
 
   if (now - last_displayRefresh >= INTERVAL_DISPLAYREFRESH)
-    display_refresh();
+    PROFILE(TASK_DISPLAYREFRESH, now - last_displayRefresh - INTERVAL_DISPLAYREFRESH, display_refresh());
+
+  if (now - last_heapCheck >= INTERVAL_HEAPCHECK)
+    PROFILE(TASK_HEAPCHECK, now - last_heapCheck - INTERVAL_HEAPCHECK, heap_check());
+
+  if (now - last_sunriseSync >= INTERVAL_SUNRISESYNC)
+    PROFILE(TASK_SUNRISESYNC, now - last_sunriseSync - INTERVAL_SUNRISESYNC, sunrise_sync());
+
+  PROFILE(TASK_EVENTS, 0, events.dispatch());
+
+  // last, so it only gets what the tasks left; prints only what fits the uart fifo
+  PROFILE(TASK_LOGDRAIN, 0, Log::drain(Serial));
+
+#ifdef PROFILE_LOOP
+  profiler.loopEnd();
+#endif
 }
 void check_connectivity()
 {
-  if (!WiFi.isConnected() || WiFi.localIP().toString().startsWith("169.254"))
+  if (wifi.update())
+    events.publish(EventType::NetworkStateChanged, (uint8_t)wifi.state());
+
+  last_ConnCheck = millis();
+}
+void on_networkStateChanged(const Event &event)
+{
+  switch ((WifiState)event.Value)
   {
-    connectionRetryCount++;
-    SSD1306_Utils::write_string(screen, 12, 0, small_font, "Retry " + String(connectionRetryCount));
-    screen->refresh();
+  case WifiState::Connecting:
+    status_text("Retry %u", wifi.attempt());
+    displayRefreshNeeded = true;
+    break;
 
-    WiFi.reconnect();
-    if (WiFi.waitForConnectResult() != WL_CONNECTED)
-    {
-      SSD1306_Utils::write_string(screen, 12, 0, small_font, "Failed " + String(connectionRetryCount));
-      screen->refresh();
+  case WifiState::Backoff:
+    status_text("Failed %u", wifi.attempt());
+    displayRefreshNeeded = true;
+    break;
 
-      last_ConnCheck = millis();
-    }
+  case WifiState::Connected:
+    screen->clear_buffer();
+    SSD1306_Utils::write_char(screen, 0, 0, icon_font, (char)Icons::Wifi); // Wifi Logo
+    status_text("%u.%u.%u.%u", WiFi.localIP()[0], WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
+    status_icons();
+    break;
+
+  default:
+    break;
   }
-  else
-  {
-    if (connectionRetryCount != 0)
-    {
-      connectionRetryCount = 0;
-      screen->clear_buffer();
-      SSD1306_Utils::write_char(screen, 0, 0, icon_font, (char)Icons::Wifi); // Wifi Logo
-      SSD1306_Utils::write_string(screen, 12, 0, small_font, WiFi.localIP().toString());
-      screen->refresh();
-    }
+}
+// Status text that runs past its columns scrolls within them, one column per
+// activity blink, so the icons either side of it and the activity pixel stay put.
+void status_text(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vsnprintf(statusText, sizeof(statusText), format, args);
+  va_end(args);
+
+  statusTextWidth = 0;
+  for (const char *c = statusText; *c; c++)
+    statusTextWidth += small_font->getCharWidth(*c) + small_font->getCharGap(*c);
+  statusOffset = 0;
+  status_draw();
+}
+void status_draw()
+{
+  screen->set_clip(STATUS_X, STATUS_END);
+  for (uint8_t x = STATUS_X; x <= STATUS_END; x++)
+    for (uint8_t y = 0; y < STATUS_ROWS; y++)
+      screen->set_pixel(x, y, false);
+
+  status_draw_at(STATUS_X - statusOffset);
+  if (statusTextWidth > STATUS_WIDTH)
+    status_draw_at(STATUS_X - statusOffset + statusTextWidth + STATUS_SCROLL_GAP);
+  screen->set_clip(0, 127);
 
-    last_ConnCheck = millis();
+  displayRefreshNeeded = true;
+}
+void status_draw_at(int16_t x)
+{
+  for (const char *c = statusText; *c && x <= STATUS_END; c++)
+  {
+    const uint8_t w = small_font->getCharWidth(*c) + small_font->getCharGap(*c);
+    if (x + w > STATUS_X) // at most one glyph left of the clip, so x stays positive
+      SSD1306_Utils::write_char(screen, x, 0, small_font, *c);
+    x += w;
   }
 }
+void status_scroll()
+{
+  if (otaActive || statusTextWidth <= STATUS_WIDTH)
+    return;
+
+  statusOffset = (statusOffset + 1) % (statusTextWidth + STATUS_SCROLL_GAP);
+  status_draw();
+}
 void pixel_blink()
 {
   activityPixelState = !activityPixelState;
+  status_scroll();
   screen->set_pixel(127, 0, activityPixelState);
   displayRefreshNeeded = true;
 
@@ -452,57 +786,102 @@ void pixel_blink()
 }
 void check_ota()
 {
-  ArduinoOTA.handle();
+  // while alarming the invitation is left unanswered, espota retries and gives up
+  // rather than have the update reboot us mid-sunrise
+  if (!alarming)
+    ArduinoOTA.handle();
 
   last_OTA = millis();
 }
 
+void ota_keepalive()
+{
+  uint32_t now = millis();
+
+  if (now - last_timeUpdate >= INTERVAL_TIMEUPDATE)
+    time_update();
+
+  if (now - last_alarmCheck >= INTERVAL_ALARMCHECK)
+    check_alarms();
+
+  if (now - last_alarmVisuals >= INTERVAL_ALARMVISUALS)
+    alarm_visuals();
+
+  if (now - last_ledUpdate >= INTERVAL_LEDUPDATE)
+    led_update();
+
+  events.dispatch();
+}
 void colour_cycle()
 {
   if (!colorCycleEnabled)
     return;
 
-  if (led_colours[colourCycle_currentIndex] == 255)
+  uint8_t *leds = compositor.edit_layer(LAYER_COLOURCYCLE);
+  if (leds[colourCycle_currentIndex] == 255)
   {
-    led_colours[colourCycle_currentIndex] = 0;
+    leds[colourCycle_currentIndex] = 0;
     ++colourCycle_currentIndex %= NUM_LED_COLORS;
   }
-  led_colours[colourCycle_currentIndex] += 1;
+  leds[colourCycle_currentIndex] += 1;
 
-  SSD1306_Utils::write_string(screen, 109, 16, small_font, "   ");
-  SSD1306_Utils::write_string(screen, 109, 16, small_font, String(colourCycle_currentIndex));
-  SSD1306_Utils::write_string(screen, 109, 24, small_font, "   ");
-  SSD1306_Utils::write_string(screen, 109, 24, small_font, String(led_colours[colourCycle_currentIndex]));
+  SSD1306_Utils::write_int(screen, 109, 16, small_font, colourCycle_currentIndex, 3);
+  SSD1306_Utils::write_int(screen, 109, 24, small_font, leds[colourCycle_currentIndex], 3);
   displayRefreshNeeded = true;
 
   last_colorCycle = millis();
 }
 void time_update()
 {
-  timeUpdateSuccess = timeClient.update();
+  // cheap unless a reply is pending or the second rolled over
+  if (systemClock.update(wifi.connected()))
+  {
+    const bool healthy = systemClock.healthy();
+    if (healthy != timeUpdateSuccess)
+    {
+      timeUpdateSuccess = healthy;
+      events.publish(EventType::TimeSynced, healthy);
+    }
 
-  if (timeClient.getHours() <= 6 || timeClient.getHours() >= 21) // 9pm - 6am
-    displayAutoOff = true;
-  else
-    displayAutoOff = false;
+    const uint8_t hours = systemClock.local().Hours;
+    if (nightStart > nightEnd ? hours >= nightStart || hours < nightEnd : hours >= nightStart && hours < nightEnd)
+      displayAutoOff = true;
+    else
+      displayAutoOff = false;
+  }
 
   last_timeUpdate = millis();
 }
 void time_draw()
 {
-  char timeString[8];
-  sprintf(timeString, "%02d:%02d:%02d", timeClient.getHours(), timeClient.getMinutes(), timeClient.getSeconds());
+  const LocalTime &time = systemClock.local();
+  char timeString[9];
+  sprintf(timeString, "%02d:%02d:%02d", time.Hours, time.Minutes, time.Seconds);
+
+  SSD1306_Utils::write_string(screen, 12, 12, medium_font, timeString);
+
+  displayRefreshNeeded = true;
+  last_timeDraw = millis();
+}
+// bell and network icons, only redrawn when what they show changes
+void status_icons()
+{
+  if (otaActive)
+    return; // the progress screen owns the display
+
   bool anyAlarmEnabled = false;
-  for (uint8_t i = 0; i < ALARM_COUNT; i++)
+  for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
     if (alarms[i].Enabled)
       anyAlarmEnabled = true;
 
-  SSD1306_Utils::write_string(screen, 12, 12, medium_font, timeString);
   SSD1306_Utils::write_char(screen, 0, 10, icon_font, (char)(anyAlarmEnabled || alarming ? alarming ? Icons::BellRinging : Icons::Bell : Icons::Empty));
   SSD1306_Utils::write_char(screen, 0, 19, icon_font, (char)(timeUpdateSuccess ? Icons::Empty : Icons::Network));
 
   displayRefreshNeeded = true;
-  last_timeDraw = millis();
+}
+void on_statusChanged(const Event &event)
+{
+  status_icons();
 }
 void check_webserver()
 {
@@ -527,9 +906,12 @@ void led_update()
 {
   delay(0);
 
+  compositor.compose();
+  strips.prepare(led_colours);
+
   os_intr_lock();
 
-  swi_write_ext(led_colours, NUM_LED_COLORS, 1);
+  strips.write();
 
   os_intr_unlock();
 
@@ -537,115 +919,199 @@ void led_update()
 }
 void check_alarms()
 {
-  if (!alarming)
+  uint8_t i;
+  uint32_t epoch;
+  const uint32_t now = systemClock.local().Utc;
+
+  static bool restoredClockWarned = false;
+
+  // a clock that was never set reads 1970, there is nothing to go on until ntp
+  if (systemClock.source() == ClockSource::None)
   {
-    // loop through alarms, check and trigger if needed
-    for (uint8_t i = 0; i < ALARM_COUNT && !alarming; i++)
-    {
-      auto alarm = &alarms[i];
+    last_alarmCheck = millis();
+    return;
+  }
 
-      if (alarm->Enabled && alarm->Hour == timeClient.getHours() && alarm->Minute == timeClient.getMinutes())
-      {
-        if (alarm->SingleShot())
-        {
-          Serial.printf("Single shot alarm triggered:\r\n  i: %d %d:%d %dm\r\n", i, timeClient.getHours(), timeClient.getMinutes(), alarm->Duration == 0 ? 5 : alarm->Duration * 15);
-          alarming = true;
-          alarm->Enabled = false;
-          saveAlarms();
-        }
-        else if (alarm->EnabledForDay(timeClient.getDay()))
-        {
-          Serial.printf("Repeating alarm triggered:\r\n i: %d %d:%d %dm %d%d%d%d%d%d%d\r\n", i, timeClient.getHours(), timeClient.getMinutes(), alarm->Duration == 0 ? 5 : alarm->Duration * 15, alarm->EnabledForDay(0), alarm->EnabledForDay(1), alarm->EnabledForDay(2), alarm->EnabledForDay(3), alarm->EnabledForDay(4), alarm->EnabledForDay(5), alarm->EnabledForDay(6));
-          alarming = true;
-        }
-
-        if (alarming)
-        {
-          alarming_alarm = i;
-          alarming_remainder = alarm->Duration * 15;
-          if (alarming_remainder == 0)
-            alarming_remainder = 5;
-          alarming_remainder = (alarming_remainder * 60 * 1000) / INTERVAL_ALARMCHECK;
-        }
-      }
-    }
+  // a flash restored clock runs behind by the power cut plus up to CLOCK_FLASH_INTERVAL, so alarms
+  // fire that late rather than never; when ntp steps it forward the scheduler catches up on running alarms
+  if (!systemClock.trusted() && !restoredClockWarned)
+  {
+    LOG_WARN("Alarms running on a flash restored clock");
+    restoredClockWarned = true;
   }
-  else
+
+  // deadlines are absolute, so anything that came due during a stall is still returned here
+  while (scheduler.poll(now, i, epoch))
   {
-    if (--alarming_remainder == 0)
+    auto alarm = &alarms[i];
+    uint32_t length = alarm->Length();
+    uint32_t late = now - epoch;
+
+    if (alarm->SingleShot())
     {
-      alarming = false;
-      Serial.println("Alarm ended");
+      alarm->Enabled = false;
+      saveAlarms();
+      scheduler.invalidate();
     }
+
+    if (alarming)
+    {
+      LOG_INFO("Alarm %d skipped, alarm %d is active", i, alarming_alarm);
+      continue;
+    }
+    if (late >= length)
+    {
+      LOG_WARN("Alarm %d missed by %ds", i, late);
+      continue;
+    }
+
+    LOG_INFO("%s alarm %d triggered: %02d:%02d:%02d lead %ds length %ds late %ds", alarm->SingleShot() ? "Single shot" : "Repeating", i, alarm->Hour, alarm->Minute, alarm->Second, alarm->Lead(), length, late);
+    startAlarm(i, length * 1000, late * 1000, epoch);
+  }
+
+  if (alarming && alarm_elapsed() >= alarming_length)
+  {
+    alarming = false;
+    LOG_INFO("Alarm ended");
+    events.publish(EventType::AlarmEnded, alarming_alarm);
   }
 
   last_alarmCheck = millis();
 }
+void startAlarm(uint8_t index, uint32_t length, uint32_t elapsed, uint32_t epoch)
+{
+  alarming = true;
+  alarming_alarm = index;
+  alarming_length = length;
+  alarming_started = millis() - elapsed; // back-dated so a late start picks up mid-curve
+  alarming_epoch = epoch;
+
+  sunriseComplete = false;
+  flashOn = false;
+  compositor.clear(LAYER_ALARM);
+  events.publish(EventType::AlarmStarted, index);
+}
+void on_alarmStarted(const Event &event)
+{
+  compositor.set_enabled(LAYER_ALARM, true);
+}
+// the alarm layer is torn down once here, rather than checked for on every visuals tick
+void on_alarmEnded(const Event &event)
+{
+  if (alarming)
+    return; // another alarm took over before this was dispatched
+
+  compositor.set_enabled(LAYER_ALARM, false);
+  compositor.clear(LAYER_ALARM);
+  sunriseComplete = false;
+  flashOn = false;
+
+  alarming_alarm = ALARM_CAPACITY;
+}
+uint32_t alarm_elapsed()
+{
+  return millis() - alarming_started;
+}
+// follows the lowest numbered unit running the same alarm, by moving our start time
+void sunrise_sync()
+{
+  SyncAlarm alarm;
+  if (alarming)
+  {
+    alarm.Epoch = alarming_epoch;
+    alarm.Curve = alarms[alarming_alarm].Sunrise() ? SyncCurve::Sunrise : SyncCurve::Flash;
+    alarm.Elapsed = alarm_elapsed();
+    alarm.Length = alarming_length;
+  }
+
+  alarming_started -= sunriseSync.update(wifi.connected(), alarming ? &alarm : nullptr);
+
+  last_sunriseSync = millis();
+}
 void alarm_visuals()
 {
   if (alarming)
   {
-    if (alarms[alarming_alarm].Duration < 4) // minimum sunrise is 1 hour, flash if less
+    if (!alarms[alarming_alarm].Sunrise())
       alarm_flash();
     else
       alarm_sunrise();
   }
-  else if (alarming_alarm != ALARM_COUNT) // end of the alarm (no longer alarming but not reset)
-  {
-    resetLeds();
-    sunriseComplete = false;
-    sunriseRemaining = 0;
-
-    alarming_alarm = ALARM_COUNT;
-  }
 
   last_alarmVisuals = millis();
 }
 void button_check()
 {
-  if (buttonPressed)
-    buttonPressedCount++;
-  else if (buttonPressedCount)
-  {
-    buttonPressedCount = 0;
-  }
+  ButtonGesture gesture;
 
-  if (buttonPressedCount)
+  button.update();
+  while (button.next(gesture))
   {
     displayLastActivity = millis();
-    SSD1306_Utils::write_char(screen, 109, 12, icon_font, (char)Icons::Button);
-    SSD1306_Utils::write_string(screen, 109, 24, small_font, String(buttonPressedCount));
-  }
-  else
-  {
-    SSD1306_Utils::write_char(screen, 109, 12, icon_font, (char)Icons::Empty);
-    SSD1306_Utils::write_string(screen, 109, 24, small_font, "   ");
+    button_action(gesture);
   }
 
-  if (alarming)
+  // held time in tenths, only redrawn when it changes
+  const uint32_t held = button.pressed() ? button.heldFor() / 100 + 1 : 0;
+  const uint8_t ticks = held > 255 ? 255 : held;
+  if (ticks != buttonHeldTicks)
   {
-    if (buttonPressedCount >= (2500 / INTERVAL_BUTTONCHECK)) // 2.5 seconds to cancel alarm
+    buttonHeldTicks = ticks;
+    if (ticks)
     {
-      alarming_remainder = 0;
-      alarming = false;
-      buttonPressedCount = 0;
+      displayLastActivity = millis();
+      SSD1306_Utils::write_char(screen, 109, 12, icon_font, (char)Icons::Button);
+      SSD1306_Utils::write_int(screen, 109, 24, small_font, ticks - 1, 3);
     }
-  }
-  else
-  {
-    if (buttonPressedCount == 3 && torching) // 300ms, reset torch
+    else
     {
-      resetLeds();
-      torching = 0;
+      SSD1306_Utils::write_char(screen, 109, 12, icon_font, (char)Icons::Empty);
+      SSD1306_Utils::write_string(screen, 109, 24, small_font, "   ");
     }
-    if (buttonPressedCount && buttonPressedCount % 5 == 0) // every 500ms, increment torch
+  }
+
+  last_buttonCheck = millis();
+}
+void button_action(ButtonGesture &gesture)
+{
+  ButtonAction action = ButtonAction::None;
+  for (auto &binding : gestureBindings)
+  {
+    if (binding.Event == gesture.Event && binding.Alarming == alarming && gesture.Duration >= binding.MinDuration)
     {
-      torching++;
-      setTorch();
+      action = binding.Action;
+      break;
     }
   }
 
-  last_buttonCheck = millis();
+  switch (action)
+  {
+  case ButtonAction::TorchStep:
+    torching++;
+    events.publish(EventType::TorchChanged, torching);
+    break;
+
+  case ButtonAction::TorchOff:
+    torching = 0;
+    events.publish(EventType::TorchChanged, torching);
+    compositor.set_enabled(LAYER_API, false);
+    break;
+
+  case ButtonAction::AlarmCancel:
+    alarming_length = 0;
+    alarming = false;
+    events.publish(EventType::AlarmEnded, alarming_alarm);
+    break;
+
+  default:
+    break;
+  }
+}
+void heap_check()
+{
+  heap.sample();
+
+  last_heapCheck = millis();
 }
 void display_refresh()
 {
@@ -700,6 +1166,7 @@ ApiMethodResponse api_getColourCycle(String &requestBody)
 ApiMethodResponse api_toggleColourCycle(String &requestBody)
 {
   colorCycleEnabled = !colorCycleEnabled;
+  compositor.set_enabled(LAYER_COLOURCYCLE, colorCycleEnabled);
 
   return ApiMethodResponse();
 }
@@ -711,27 +1178,45 @@ ApiMethodResponse api_resetLeds(String &requestBody)
 }
 ApiMethodResponse api_testAlarmOn(String &requestBody)
 {
-  alarming = 1;
-  alarming_alarm = 0;
-  alarming_remainder = 90;
-  alarming_remainder = (alarming_remainder * 60 * 1000) / INTERVAL_ALARMCHECK;
+  startAlarm(0, 90 * 60 * 1000UL, 0, systemClock.local().Utc);
 
   return ApiMethodResponse();
 }
 ApiMethodResponse api_testAlarmOff(String &requestBody)
 {
-  alarming_remainder = 1;
+  alarming_length = 0;
   return ApiMethodResponse();
 }
-ApiMethodResponse api_format(String &requestBody)
+// SPIFFS.format() holds the loop for seconds, so files are removed one per
+// step instead; a file that won't go means a damaged fs and a real format
+bool api_format(ApiTask &task)
 {
-  ApiMethodResponse response;
+  switch (task.Stage)
+  {
+  case 0:
+  {
+    auto dir = SPIFFS.openDir("");
+    if (!dir.next())
+      task.Stage = 2;
+    else if (!SPIFFS.remove(dir.fileName()))
+      task.Stage = 1;
+    return false;
+  }
 
-  SPIFFS.end();
-  response.Error = SPIFFS.format() ? ErrorState::None : ErrorState::InternalServerError;
-  SPIFFS.begin();
+  case 1:
+    LOG_WARN("FS: Remove failed, formatting");
+    SPIFFS.end();
+    if (!SPIFFS.format())
+      task.Response.Error = ErrorState::InternalServerError;
+    SPIFFS.begin();
+    task.Stage = 2;
+    return false;
 
-  return response;
+  default:
+    alarmStore.reset();
+    webserver.IndexFiles();
+    return true;
+  }
 }
 ApiMethodResponse api_getLeds(String &requestBody)
 {
@@ -778,6 +1263,7 @@ ApiMethodResponse api_setLeds(String &requestBody)
     return response;
   }
 
+  uint8_t *layer = compositor.edit_layer(LAYER_API);
   JsonArray leds = doc["leds"];
   for (uint8_t i = 0; i < NUM_LEDS; i++)
   {
@@ -789,14 +1275,13 @@ ApiMethodResponse api_setLeds(String &requestBody)
     int leds_w = led["w"];
 
     //G, R, B, W
-    led_colours[(i * 4) + 0] = leds_g;
-    led_colours[(i * 4) + 1] = leds_r;
-    led_colours[(i * 4) + 2] = leds_b;
-    led_colours[(i * 4) + 3] = leds_w;
-    Serial.printf("%d, %d, %d, %d\r\n", leds_r, leds_g, leds_b, leds_w);
-
-    torching = 1;
+    layer[(i * 4) + 0] = leds_g;
+    layer[(i * 4) + 1] = leds_r;
+    layer[(i * 4) + 2] = leds_b;
+    layer[(i * 4) + 3] = leds_w;
+    LOG_DEBUG("%d, %d, %d, %d", leds_r, leds_g, leds_b, leds_w);
   }
+  compositor.set_enabled(LAYER_API, true);
 
   return response;
 }
@@ -804,16 +1289,164 @@ ApiMethodResponse api_getAlarms(String &requestBody)
 {
   ApiMethodResponse response;
   response.Body = serializeAlarms();
+  response.ETag = alarmsETag();
+  response.Type = ResponseType::Json;
+  return response;
+}
+// parsing and the flash write are separate steps, so a long body doesn't take both out of one slice;
+// the table is parsed into a copy and only goes live in the step that saves it and reschedules
+bool api_setAlarms(ApiTask &task)
+{
+  static Alarm staged[ALARM_CAPACITY];
+
+  switch (task.Stage++)
+  {
+  case 0:
+    if (!preconditionMet(alarmsETag()))
+    {
+      task.Response.Error = ErrorState::PreconditionFailed;
+      return true;
+    }
+
+    if (!deserializeAlarms(task.RequestBody, staged))
+    {
+      task.Response.Error = ErrorState::BadRequest;
+      return true;
+    }
+    return false;
+
+  default:
+    for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
+      alarms[i] = staged[i];
+    const bool saved = saveAlarms();
+    scheduler.invalidate();
+
+    if (!saved)
+      task.Response.Error = ErrorState::InternalServerError;
+    else
+      task.Response.ETag = alarmsETag();
+    return true;
+  }
+}
+ApiMethodResponse api_getAlarm(String &requestBody)
+{
+  ApiMethodResponse response;
+  uint8_t index;
+
+  if (!parseAlarmId(index))
+  {
+    response.Error = ErrorState::NotFound;
+    return response;
+  }
+
+  response.Body = serializeAlarm(index);
+  response.ETag = alarmETag(index);
+  response.Type = ResponseType::Json;
+  return response;
+}
+ApiMethodResponse api_putAlarm(String &requestBody)
+{
+  return updateAlarm(requestBody, false);
+}
+ApiMethodResponse api_patchAlarm(String &requestBody)
+{
+  return updateAlarm(requestBody, true);
+}
+ApiMethodResponse api_deleteAlarm(String &requestBody)
+{
+  ApiMethodResponse response;
+  uint8_t index;
+
+  if (!parseAlarmId(index))
+  {
+    response.Error = ErrorState::NotFound;
+    return response;
+  }
+  if (!preconditionMet(alarmETag(index)))
+  {
+    response.Error = ErrorState::PreconditionFailed;
+    return response;
+  }
+
+  alarms[index] = Alarm();
+  const bool saved = saveAlarms();
+  scheduler.invalidate();
+
+  if (!saved)
+  {
+    response.Error = ErrorState::InternalServerError;
+    return response;
+  }
+
+  response.ETag = alarmETag(index);
+  return response;
+}
+ApiMethodResponse updateAlarm(String &requestBody, bool partial)
+{
+  ApiMethodResponse response;
+  uint8_t index;
+
+  if (!parseAlarmId(index))
+  {
+    response.Error = ErrorState::NotFound;
+    return response;
+  }
+  if (!preconditionMet(alarmETag(index)))
+  {
+    response.Error = ErrorState::PreconditionFailed;
+    return response;
+  }
+
+  const size_t capacity = JSON_OBJECT_SIZE(6) + 60;
+  DynamicJsonDocument doc(capacity);
+
+  // validate into a copy so a bad request leaves the alarm untouched
+  Alarm alarm = alarms[index];
+  if (deserializeJson(doc, requestBody) || !doc.is<JsonObject>() || !deserializeAlarm(doc.as<JsonObject>(), alarm, partial))
+  {
+    response.Error = ErrorState::BadRequest;
+    return response;
+  }
+
+  alarms[index] = alarm;
+  const bool saved = saveAlarms();
+  scheduler.invalidate();
+
+  if (!saved)
+  {
+    response.Error = ErrorState::InternalServerError;
+    return response;
+  }
+
+  response.Body = serializeAlarm(index);
+  response.ETag = alarmETag(index);
   response.Type = ResponseType::Json;
   return response;
 }
-ApiMethodResponse api_setAlarms(String &requestBody)
+ApiMethodResponse api_getTime(String &requestBody)
+{
+  ApiMethodResponse response;
+  response.Body = serializeTimeConfig();
+  response.Type = ResponseType::Json;
+  return response;
+}
+ApiMethodResponse api_setTime(String &requestBody)
 {
   ApiMethodResponse response;
 
-  deserializeAlarms(requestBody);
-  saveAlarms();
+  if (!deserializeTimeConfig(requestBody))
+  {
+    response.Error = ErrorState::BadRequest;
+    return response;
+  }
+  if (!saveTimeConfig())
+  {
+    response.Error = ErrorState::InternalServerError;
+    return response;
+  }
 
+  response.Body = serializeTimeConfig();
+  response.Type = ResponseType::Json;
   return response;
 }
 ApiMethodResponse api_getState(String &requestBody)
@@ -823,97 +1456,318 @@ ApiMethodResponse api_getState(String &requestBody)
   response.Type = ResponseType::Json;
   return response;
 }
+ApiMethodResponse api_getHeap(String &requestBody)
+{
+  ApiMethodResponse response;
+  response.Body = serializeHeap();
+  response.Type = ResponseType::Json;
+  return response;
+}
+// hex records, one per line, for tools/log_decode.py
+ApiMethodResponse api_getLog(String &requestBody)
+{
+  ApiMethodResponse response;
+  response.Body = Log::dump();
+  response.Type = ResponseType::Text;
+  return response;
+}
+ApiMethodResponse api_getProfile(String &requestBody)
+{
+  ApiMethodResponse response;
+#ifdef PROFILE_LOOP
+  response.Body = serializeProfile();
+  response.Type = ResponseType::Json;
+#else
+  response.Error = ErrorState::NotFound;
+#endif
+  return response;
+}
+ApiMethodResponse api_resetProfile(String &requestBody)
+{
+  ApiMethodResponse response;
+#ifdef PROFILE_LOOP
+  profiler.reset();
+#else
+  response.Error = ErrorState::NotFound;
+#endif
+  return response;
+}
 
-void deserializeAlarms(String &json)
+// target is only written when the whole table is valid
+bool deserializeAlarms(String &json, Alarm *target)
 {
-  const size_t capacity = JSON_ARRAY_SIZE(ALARM_COUNT) + ALARM_COUNT * JSON_OBJECT_SIZE(5) + (ALARM_COUNT + 1) * 40;
+  const size_t capacity = JSON_ARRAY_SIZE(ALARM_CAPACITY) + ALARM_CAPACITY * JSON_OBJECT_SIZE(6) + (ALARM_CAPACITY + 1) * 40;
   DynamicJsonDocument doc(capacity);
 
-  deserializeJson(doc, json);
+  if (deserializeJson(doc, json) || !doc.is<JsonArray>() || doc.size() > ALARM_CAPACITY)
+    return false;
 
-  for (uint8_t i = 0; i < ALARM_COUNT; i++)
+  Alarm parsed[ALARM_CAPACITY];
+  for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
   {
-    JsonObject node = doc[i];
-
-    alarms[i].Enabled = node["Enabled"];
-    alarms[i].Hour = node["Hour"];
-    alarms[i].Minute = node["Minute"];
-    alarms[i].Duration = node["Duration"];
-    alarms[i].RepeatDays = node["RepeatDays"];
+    parsed[i] = Alarm();
+    if (i < doc.size() && !deserializeAlarm(doc[i], parsed[i], false))
+      return false;
   }
+
+  for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
+    target[i] = parsed[i];
+  return true;
 }
-String serializeAlarms()
+// The old api stored any uint8 in every field, so migrated fields are clamped
+// into range rather than rejecting the file; a missing record stays disabled.
+bool deserializeLegacyAlarms(String &json)
 {
-  const size_t capacity = JSON_ARRAY_SIZE(ALARM_COUNT) + ALARM_COUNT * JSON_OBJECT_SIZE(5);
+  const size_t capacity = JSON_ARRAY_SIZE(ALARM_CAPACITY) + ALARM_CAPACITY * JSON_OBJECT_SIZE(6) + (ALARM_CAPACITY + 1) * 40;
   DynamicJsonDocument doc(capacity);
 
-  for (uint8_t i = 0; i < ALARM_COUNT; i++)
+  if (deserializeJson(doc, json) || !doc.is<JsonArray>())
+    return false;
+
+  for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
   {
-    JsonObject node = doc.createNestedObject();
+    JsonObject node = doc[i];
+
+    alarms[i] = Alarm();
+    if (node.isNull())
+      continue;
 
-    node["Enabled"] = alarms[i].Enabled;
-    node["Hour"] = alarms[i].Hour;
-    node["Minute"] = alarms[i].Minute;
-    node["Duration"] = alarms[i].Duration;
-    node["RepeatDays"] = alarms[i].RepeatDays;
+    alarms[i].Enabled = node["Enabled"].as<bool>();
+    alarms[i].Hour = constrain(node["Hour"].as<int>(), 0, 23);
+    alarms[i].Minute = constrain(node["Minute"].as<int>(), 0, 59);
+    alarms[i].Second = constrain(node["Second"].as<int>(), 0, 59);
+    alarms[i].Duration = constrain(node["Duration"].as<int>(), 0, 255);
+    alarms[i].RepeatDays = node["RepeatDays"].as<int>() & 0x7F;
   }
+  return true;
+}
+bool deserializeAlarm(JsonObject node, Alarm &alarm, bool partial)
+{
+  if (node.isNull())
+    return false;
+
+  JsonVariant enabled = node["Enabled"];
+  if (enabled.isNull() ? !partial : !enabled.is<bool>())
+    return false;
+  if (!enabled.isNull())
+    alarm.Enabled = enabled.as<bool>();
+
+  // Second is optional even for a full update, older clients never send it
+  return deserializeAlarmField(node["Hour"], alarm.Hour, 23, partial)
+    && deserializeAlarmField(node["Minute"], alarm.Minute, 59, partial)
+    && deserializeAlarmField(node["Second"], alarm.Second, 59, true)
+    && deserializeAlarmField(node["Duration"], alarm.Duration, 255, partial)
+    && deserializeAlarmField(node["RepeatDays"], alarm.RepeatDays, 127, partial);
+}
+bool deserializeAlarmField(JsonVariant value, uint8_t &field, uint8_t max, bool optional)
+{
+  if (value.isNull())
+    return optional;
+  if (!value.is<int>() || value.as<int>() < 0 || value.as<int>() > max)
+    return false;
+
+  field = value.as<int>();
+  return true;
+}
+void serializeAlarm(JsonObject node, Alarm &alarm)
+{
+  node["Enabled"] = alarm.Enabled;
+  node["Hour"] = alarm.Hour;
+  node["Minute"] = alarm.Minute;
+  node["Second"] = alarm.Second;
+  node["Duration"] = alarm.Duration;
+  node["RepeatDays"] = alarm.RepeatDays;
+}
+String serializeAlarm(uint8_t index)
+{
+  const size_t capacity = JSON_OBJECT_SIZE(6);
+  DynamicJsonDocument doc(capacity);
+
+  serializeAlarm(doc.to<JsonObject>(), alarms[index]);
+
+  String json;
+  serializeJson(doc, json);
+
+  return json;
+}
+String serializeAlarms()
+{
+  const size_t capacity = JSON_ARRAY_SIZE(ALARM_CAPACITY) + ALARM_CAPACITY * JSON_OBJECT_SIZE(6);
+  DynamicJsonDocument doc(capacity);
+
+  for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
+    serializeAlarm(doc.createNestedObject(), alarms[i]);
 
   String json;
   serializeJson(doc, json);
 
   return json;
 }
-void saveAlarms()
+bool parseAlarmId(uint8_t &index)
 {
-  if (SPIFFS.exists(ALARM_FILE_NAME))
+  const String &id = webserver.PathParameter();
+
+  if (id.length() == 0 || id.length() > 3)
+    return false;
+  for (uint8_t i = 0; i < id.length(); i++)
+    if (!isDigit(id[i]))
+      return false;
+
+  const long value = id.toInt();
+  if (value >= ALARM_CAPACITY)
+    return false;
+
+  index = value;
+  return true;
+}
+// etags are the crc32 of the stored record(s), so they survive reboots
+String alarmETag(uint8_t index)
+{
+  uint8_t record[ALARMSTORE_RECORD_SIZE];
+  AlarmStore::encode(alarms[index], record);
+
+  char etag[9];
+  sprintf(etag, "%08x", Checksum::crc32(record, ALARMSTORE_RECORD_SIZE));
+  return String(etag);
+}
+String alarmsETag()
+{
+  uint32_t crc = 0;
+  uint8_t record[ALARMSTORE_RECORD_SIZE];
+  for (uint8_t i = 0; i < ALARM_CAPACITY; i++)
   {
-    SPIFFS.remove(ALARM_FILE_NAME);
+    AlarmStore::encode(alarms[i], record);
+    crc = Checksum::crc32(record, ALARMSTORE_RECORD_SIZE, crc);
   }
 
-  String json = serializeAlarms();
+  char etag[9];
+  sprintf(etag, "%08x", crc);
+  return String(etag);
+}
+bool preconditionMet(const String &etag)
+{
+  const String &ifMatch = webserver.IfMatch();
+  if (ifMatch.length() == 0 || ifMatch == "*")
+    return true;
+
+  return ifMatch == "\"" + etag + "\"" || ifMatch == etag;
+}
+bool deserializeTimeConfig(String &json)
+{
+  const size_t capacity = JSON_OBJECT_SIZE(3) + TZ_SPEC_LENGTH + 40;
+  DynamicJsonDocument doc(capacity);
+
+  if (deserializeJson(doc, json) || !doc.is<JsonObject>())
+    return false;
 
-  auto f = SPIFFS.open(ALARM_FILE_NAME, "w");
-  f.print(json);
+  // validate everything before applying anything
+  JsonVariant zone = doc["TimeZone"];
+  TimeZone parsed;
+  if (!zone.isNull() && (!zone.is<const char *>() || !parsed.parse(zone.as<const char *>())))
+    return false;
+
+  uint8_t start = nightStart, end = nightEnd;
+  if (!deserializeAlarmField(doc["NightStart"], start, 23, true) || !deserializeAlarmField(doc["NightEnd"], end, 23, true))
+    return false;
+
+  if (!zone.isNull())
+    timeZone.parse(zone.as<const char *>());
+  nightStart = start;
+  nightEnd = end;
+
+  // local time and every queued alarm depend on the zone
+  systemClock.invalidateLocal();
+  scheduler.invalidate();
+  return true;
+}
+String serializeTimeConfig()
+{
+  const size_t capacity = JSON_OBJECT_SIZE(8);
+  DynamicJsonDocument doc(capacity);
+
+  doc["TimeZone"] = timeZone.spec();
+  doc["NightStart"] = nightStart;
+  doc["NightEnd"] = nightEnd;
+  doc["Utc"] = systemClock.local().Utc;
+  doc["Local"] = systemClock.local().Epoch;
+  doc["Offset"] = timeZone.currentOffset();
+  doc["Dst"] = timeZone.isDst();
+  doc["NextTransition"] = timeZone.nextTransition();
+
+  String json;
+  serializeJson(doc, json);
+
+  return json;
+}
+bool saveTimeConfig()
+{
+  const size_t capacity = JSON_OBJECT_SIZE(3);
+  DynamicJsonDocument doc(capacity);
+
+  doc["TimeZone"] = timeZone.spec();
+  doc["NightStart"] = nightStart;
+  doc["NightEnd"] = nightEnd;
+
+  // write aside and swap, setup_time() falls back to the temp file if the swap was interrupted
+  auto f = SPIFFS.open(TIME_CONFIG_TEMP_FILE_NAME, "w");
+  if (!f)
+    return false;
+  const size_t length = measureJson(doc);
+  const bool written = serializeJson(doc, f) == length;
   f.close();
+  if (!written)
+    return false;
+
+  SPIFFS.remove(TIME_CONFIG_FILE_NAME);
+  return SPIFFS.rename(TIME_CONFIG_TEMP_FILE_NAME, TIME_CONFIG_FILE_NAME);
+}
+bool saveAlarms()
+{
+  // only the records that changed since the last commit are written
+  const bool saved = alarmStore.commit();
+  if (!saved)
+    LOG_ERROR("FS: Failed to save alarms");
+  events.publish(EventType::AlarmsChanged);
+  return saved;
 }
 
 void resetLeds()
 {
-  for (uint16_t i = 0; i < NUM_LED_COLORS; i++)
-    led_colours[i] = 0;
-}
+  for (uint8_t i = 0; i < LED_LAYER_COUNT; i++)
+    compositor.clear(i);
 
-//LED Pattern
-//   1-18 inside
-//  19-36 outside
-//  37-54 inside
-//  55-72 outside
+  torching = 0;
+  events.publish(EventType::TorchChanged, torching);
+  compositor.set_enabled(LAYER_API, false);
+}
 
+void on_torchChanged(const Event &event)
+{
+  setTorch();
+}
 void setTorch()
 {
+  compositor.set_enabled(LAYER_TORCH, torching);
+  if (!torching)
+    return;
+
+  uint8_t *leds = compositor.edit_layer(LAYER_TORCH);
+  uint8_t ordinal;
   switch (torching)
   {
   case 1:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (
-        (i / 72 == 0) // inside a
-        && (i % 4 == 3) // white only
-        && ((i / 4) % 3 == 0) // every third
-      ) 
-      {
-        led_colours[i] = 1;
-      }
-      else if (
-        (i / 72 == 2) // inside b
+        strips.zone(i / 4, &ordinal) == LedZone::Inside
         && (i % 4 == 3) // white only
-        && ((i / 4) % 3 == 1) // every third shifted by 1
+        && ((i / 4) % 3 == ordinal % 3) // every third, shifted by one per inside run
       ) 
       {
-        led_colours[i] = 1;
+        leds[i] = 1;
       }
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
 
@@ -921,29 +1775,29 @@ void setTorch()
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (
-        (i / 72 == 0 || i / 72 == 2) // inside only
+        strips.zone(i / 4) == LedZone::Inside
         && (i % 4 == 3) // white only
         && ((i / 4) % 2 == 0) // every second
       ) 
       {
-        led_colours[i] = 1;
+        leds[i] = 1;
       }
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 3:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (
-        (i / 72 == 0 || i / 72 == 2) // inside only
+        strips.zone(i / 4) == LedZone::Inside
         && (i % 4 == 3) // white only
       ) 
       {
-        led_colours[i] = 1;
+        leds[i] = 1;
       }
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 4:
@@ -951,7 +1805,7 @@ void setTorch()
     {
       if (
         (
-          (i / 72 == 0 || i / 72 == 2) // inside only
+          strips.zone(i / 4) == LedZone::Inside
           && (i % 4 == 3) // white only
         ) 
         ||
@@ -961,91 +1815,91 @@ void setTorch()
         )  
       ) 
       {
-        led_colours[i] = 1;
+        leds[i] = 1;
       }
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 5:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 1;
+        leds[i] = 1;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 6:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (
-        (i / 72 == 0 || i / 72 == 2) // inside only
+        strips.zone(i / 4) == LedZone::Inside
         && (i % 4 == 3) // white only
       ) 
       {
-        led_colours[i] = 2;
+        leds[i] = 2;
       }
       else if (i % 4 == 3) // white only)
       {
-        led_colours[i] = 1;
+        leds[i] = 1;
       }
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 7:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 3;
+        leds[i] = 3;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 8:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 5;
+        leds[i] = 5;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 9:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 10;
+        leds[i] = 10;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 10:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 20;
+        leds[i] = 20;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 11:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 64;
+        leds[i] = 64;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 12:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 128;
+        leds[i] = 128;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
   case 13:
@@ -1053,12 +1907,12 @@ void setTorch()
     {
       if (i % 4 == 3) // white only
 #if defined(CURRENT_LIMIT_500)
-        led_colours[i] = 192;
+        leds[i] = 192;
 #else
-        led_colours[i] = 255;
+        leds[i] = 255;
 #endif
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
     break;
 
@@ -1067,40 +1921,40 @@ void setTorch()
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 255;
+        leds[i] = 255;
       else
-        led_colours[i] = 32;
+        leds[i] = 32;
     }
     break;
   case 19:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 255;
+        leds[i] = 255;
       else
-        led_colours[i] = 64;
+        leds[i] = 64;
     }
     break;
   case 21:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // white only
-        led_colours[i] = 255;
+        leds[i] = 255;
       else
-        led_colours[i] = 128;
+        leds[i] = 128;
     }
     break;
   case 23:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 0) // g
-        led_colours[i] = 255;
+        leds[i] = 255;
       if (i % 4 == 1) // r
-        led_colours[i] = 127;
+        leds[i] = 127;
       if (i % 4 == 2) // b
-        led_colours[i] = 218;
+        leds[i] = 218;
       if (i % 4 == 3) // w
-        led_colours[i] = 255;
+        leds[i] = 255;
     }
     break;
 #endif
@@ -1108,7 +1962,7 @@ void setTorch()
   case 24:
     for (int i = 0; i < NUM_LED_COLORS; i++)
     {
-        led_colours[i] = 255;
+        leds[i] = 255;
     }
     break;
 #endif
@@ -1120,23 +1974,24 @@ void setTorch()
 
 void alarm_flash()
 {
-  uint8_t flash = 0;
+  const uint8_t tick = (alarm_elapsed() / INTERVAL_ALARMVISUALS) % FLASH_PERIODTICKS;
+  bool on = false;
 
   for (uint8_t i = 0; i < FLASH_FLASHES; i++)
   {
     uint8_t start = i * (FLASH_ONTICKS + FLASH_OFFTICKS);
 
-    if (flashCounter == start)
-      flash = 1;
-    if (flashCounter == start + FLASH_ONTICKS)
-      flash = 2;
+    if (tick >= start && tick < start + FLASH_ONTICKS)
+      on = true;
   }
 
-  if (flash)
+  if (on != flashOn)
+  {
+    uint8_t *leds = compositor.edit_layer(LAYER_ALARM);
     for (uint16_t i = 0; i < NUM_LED_COLORS; i++)
     {
       if (i % 4 == 3) // w
-        led_colours[i] = flash == 1 ? 
+        leds[i] = on ? 
 #if defined(CURRENT_LIMIT_500)
         192
 #else
@@ -1144,30 +1999,26 @@ void alarm_flash()
 #endif
         : 0;
       else
-        led_colours[i] = 0;
+        leds[i] = 0;
     }
-
-  ++flashCounter %= FLASH_PERIODTICKS;
+    flashOn = on;
+  }
 }
 
 void alarm_sunrise()
 {
-  if (!sunriseRemaining && !sunriseComplete)
-  {
-    sunriseRemaining = SUNRISE_DURATION;
-    resetLeds();
-    //Serial.printf("Sunrse triggered, duration %d\r\n", sunriseRemaining);
-  }
+  const uint32_t elapsed = alarm_elapsed();
 
   if (!sunriseComplete)
   {
-    uint32_t currentTime = SUNRISE_DURATION - sunriseRemaining;
-    uint8_t currentColourIndex = currentTime / SUNRISE_TICKSPERCOLOUR;
+    uint8_t *leds = compositor.edit_layer(LAYER_ALARM);
+    uint32_t currentTime = elapsed < SUNRISE_DURATION ? elapsed : SUNRISE_DURATION - 1;
+    uint8_t currentColourIndex = currentTime / SUNRISE_MSPERCOLOUR;
 
-    uint32_t currentColourStartTime = currentColourIndex * SUNRISE_TICKSPERCOLOUR;
-    uint32_t nextColourStartTime = currentColourStartTime + SUNRISE_TICKSPERCOLOUR;
+    uint32_t currentColourStartTime = currentColourIndex * SUNRISE_MSPERCOLOUR;
+    uint32_t nextColourStartTime = currentColourStartTime + SUNRISE_MSPERCOLOUR;
 
-    //Serial.printf("sr: %d, ct: %d, cci:  %d, ccst: %d, ncst: %d\r\n", sunriseRemaining, currentTime, currentColourIndex, currentColourStartTime, nextColourStartTime);
+    //Serial.printf("ct: %d, cci:  %d, ccst: %d, ncst: %d\r\n", currentTime, currentColourIndex, currentColourStartTime, nextColourStartTime);
 
     for (uint8_t i = 0; i < 4; i++)
     {
@@ -1188,18 +2039,15 @@ void alarm_sunrise()
       for (uint16_t ci = i; ci < NUM_LED_COLORS; ci += 4)
       {
         if ((ci / 4) % 4 <= targetLeds)
-          led_colours[ci] = targetColour;
+          leds[ci] = targetColour;
       }
     }
 
-    if (!--sunriseRemaining)
-    {
-      sunriseRemaining = 1;
+    if (elapsed >= SUNRISE_DURATION)
       sunriseComplete = true;
-    }
   }
 
-  if (alarming_remainder * INTERVAL_ALARMCHECK < (15 * 60 * 1000))
+  if (elapsed + FLASH_TAIL_SECONDS * 1000UL > alarming_length)
   {
     alarm_flash();
   }
@@ -1207,15 +2055,25 @@ void alarm_sunrise()
 
 String serializeState()
 {
-  const size_t capacity = JSON_OBJECT_SIZE(31);
+  const size_t capacity = JSON_OBJECT_SIZE(70);
   DynamicJsonDocument doc(capacity);
 
   doc["millis"] = millis();
   doc["last_OTA"] = last_OTA;
+  doc["otaActive"] = otaActive;
   doc["last_webServerUpdate"] = last_webServerUpdate;
   doc["last_ledUpdate"] = last_ledUpdate;
   doc["last_ConnCheck"] = last_ConnCheck;
-  doc["connectionRetryCount"] = connectionRetryCount;
+  doc["wifiState"] = (uint8_t)wifi.state();
+  doc["wifiAttempt"] = wifi.attempt();
+  doc["wifiConnects"] = wifi.connects();
+  doc["wifiFastConnects"] = wifi.fastConnects();
+  doc["wifiFailures"] = wifi.failures();
+  doc["wifiDisconnects"] = wifi.disconnects();
+  doc["wifiConnectTime"] = wifi.lastConnectTime();
+  doc["wifiConnectTimeMin"] = wifi.minConnectTime();
+  doc["wifiConnectTimeMax"] = wifi.maxConnectTime();
+  doc["wifiConnectTimeAvg"] = wifi.averageConnectTime();
   doc["last_displayRefresh"] = last_displayRefresh;
   doc["displayRefreshNeeded"] = displayRefreshNeeded;
   doc["displayAutoOff"] = displayAutoOff;
@@ -1225,25 +2083,141 @@ String serializeState()
   doc["activityPixelState"] = activityPixelState;
   doc["last_timeUpdate"] = last_timeUpdate;
   doc["timeUpdateSuccess"] = timeUpdateSuccess;
+  doc["ntpRequests"] = systemClock.requests();
+  doc["ntpPollInterval"] = systemClock.pollInterval();
+  doc["ntpOffset"] = systemClock.lastOffset();
+  doc["ntpDelay"] = systemClock.lastDelay();
+  doc["ntpDrift"] = systemClock.drift();
+  doc["clockSource"] = (uint8_t)systemClock.source();
+  doc["clockTrusted"] = systemClock.trusted();
   doc["last_timeDraw"] = last_timeDraw;
   doc["last_alarmCheck"] = last_alarmCheck;
   doc["alarming"] = alarming;
-  doc["alarming_remainder"] = alarming_remainder;
+  doc["alarming_started"] = alarming_started;
+  doc["alarming_length"] = alarming_length;
   doc["alarming_alarm"] = alarming_alarm;
+  doc["nextAlarm"] = scheduler.nextIndex();
+  doc["nextAlarmEpoch"] = scheduler.nextEpoch();
   doc["last_alarmVisuals"] = last_alarmVisuals;
-  doc["sunriseRemaining"] = sunriseRemaining;
   doc["sunriseComplete"] = sunriseComplete;
-  doc["flashCounter"] = flashCounter;
+  doc["flashOn"] = flashOn;
   doc["last_colorCycle"] = last_colorCycle;
   doc["colorCycleEnabled"] = colorCycleEnabled;
   doc["colourCycle_currentIndex"] = colourCycle_currentIndex;
   doc["last_buttonCheck"] = last_buttonCheck;
-  doc["buttonPressed"] = buttonPressed;
-  doc["buttonPressedCount"] = buttonPressedCount;
+  doc["buttonPressed"] = button.pressed();
+  doc["buttonHeldFor"] = button.heldFor();
+  doc["buttonOverflows"] = button.overflows();
   doc["torching"] = torching;
+  doc["last_heapCheck"] = last_heapCheck;
+  doc["heapFree"] = heap.freeHeap();
+  doc["heapLargestBlock"] = heap.largestBlock();
+  doc["heapFragmentation"] = heap.fragmentation();
+  doc["heapMinFree"] = heap.minFreeHeap();
+  doc["heapMinLargestBlock"] = heap.minLargestBlock();
+  doc["heapMaxFragmentation"] = heap.maxFragmentation();
+  doc["stackFree"] = heap.stackFree();
+  doc["heapAllocations"] = HeapMonitor::allocations();
+  doc["displayFrameTime"] = screen->frame_time();
+  doc["ledWriteTime"] = strips.write_time();
+  doc["syncLeading"] = sunriseSync.leading();
+  doc["syncLeader"] = sunriseSync.leader();
+  doc["syncOffset"] = sunriseSync.offset();
+  doc["syncSent"] = sunriseSync.sent();
+  doc["syncReceived"] = sunriseSync.received();
+  doc["syncLost"] = sunriseSync.lost();
+  doc["eventsDropped"] = events.dropped();
+  doc["logDropped"] = Log::dropped();
+
+  String json;
+  serializeJson(doc, json);
+
+  return json;
+}
+String serializeHeap()
+{
+  const size_t capacity = JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(HEAP_TREND_LENGTH) + HEAP_TREND_LENGTH * JSON_OBJECT_SIZE(5) +
+                          JSON_ARRAY_SIZE(HEAP_SITE_COUNT) + HEAP_SITE_COUNT * JSON_OBJECT_SIZE(2);
+  DynamicJsonDocument doc(capacity);
+
+  doc["tracing"] = HeapMonitor::tracing();
+  doc["allocations"] = HeapMonitor::allocations();
+  doc["frees"] = HeapMonitor::frees();
+
+  JsonArray trend = doc.createNestedArray("trend");
+  for (uint8_t i = 0; i < heap.trendLength(); i++)
+  {
+    const HeapSample &sample = heap.trend(i);
+    JsonObject entry = trend.createNestedObject();
+    entry["time"] = sample.Time;
+    entry["free"] = sample.Free;
+    entry["largestBlock"] = sample.LargestBlock;
+    entry["fragmentation"] = sample.Fragmentation;
+    entry["stackFree"] = sample.StackFree;
+  }
+
+  // addresses as numbers, addr2line takes them in hex
+  JsonArray sites = doc.createNestedArray("sites");
+  for (uint8_t i = 0; i < HeapMonitor::siteCount(); i++)
+  {
+    JsonObject entry = sites.createNestedObject();
+    entry["address"] = HeapMonitor::site(i).Address;
+    entry["count"] = HeapMonitor::site(i).Count;
+  }
+
+  String json;
+  serializeJson(doc, json);
+
+  return json;
+}
+#ifdef PROFILE_LOOP
+String serializeProfile()
+{
+  const size_t capacity = JSON_OBJECT_SIZE(6) + JSON_ARRAY_SIZE(PROFILER_TASK_LIMIT) +
+                          PROFILER_TASK_LIMIT * (JSON_OBJECT_SIZE(8) + 2 * JSON_ARRAY_SIZE(PROFILER_BUCKETS)) +
+                          JSON_ARRAY_SIZE(PROFILER_OVERRUN_COUNT) + PROFILER_OVERRUN_COUNT * JSON_OBJECT_SIZE(3);
+  DynamicJsonDocument doc(capacity);
+
+  doc["cpuMHz"] = ESP.getCpuFreqMHz();
+  doc["since"] = profiler.lastReset();
+  doc["loops"] = profiler.loops();
+  doc["maxLoop"] = profiler.maxLoop();
+
+  // times in us, bucket n of duration and lateness counts [2^n, 2^(n+1)) us
+  JsonArray tasks = doc.createNestedArray("tasks");
+  for (uint8_t i = 0; i < profiler.taskCount(); i++)
+  {
+    const ProfilerTask &task = profiler.task(i);
+    JsonObject entry = tasks.createNestedObject();
+    entry["name"] = task.Name;
+    entry["budget"] = task.Budget;
+    entry["runs"] = task.Runs;
+    entry["max"] = task.MaxDuration;
+    entry["maxLate"] = task.MaxLateness;
+    entry["mean"] = task.Runs ? (uint32_t)(task.TotalDuration / task.Runs) : 0;
+
+    JsonArray duration = entry.createNestedArray("duration");
+    JsonArray lateness = entry.createNestedArray("lateness");
+    for (uint8_t b = 0; b < PROFILER_BUCKETS; b++)
+    {
+      duration.add(task.Duration[b]);
+      lateness.add(task.Lateness[b]);
+    }
+  }
+
+  JsonArray overruns = doc.createNestedArray("overruns");
+  for (uint8_t i = 0; i < profiler.overrunCount(); i++)
+  {
+    const ProfilerOverrun &overrun = profiler.overrun(i);
+    JsonObject entry = overruns.createNestedObject();
+    entry["time"] = overrun.Time;
+    entry["task"] = profiler.task(overrun.Task).Name;
+    entry["duration"] = overrun.Duration;
+  }
 
   String json;
   serializeJson(doc, json);
 
   return json;
 }
+#endif
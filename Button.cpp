@@ -0,0 +1,179 @@
+/*
+  Button.cpp - Debounced push button with gesture events.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "Button.h"
+
+Button::Button(uint8_t pin)
+{
+  _pin = pin;
+}
+
+void Button::begin(void (*isr)())
+{
+  pinMode(_pin, INPUT_PULLUP);
+  _raw = _pressed = !digitalRead(_pin);
+  _rawSince = _pressedAt = millis();
+  attachInterrupt(digitalPinToInterrupt(_pin), isr, CHANGE);
+}
+
+// called from the isr, keep it short and in iram
+ICACHE_RAM_ATTR void Button::edge()
+{
+  const uint8_t head = _head;
+  const uint8_t next = (head + 1) & (BUTTON_QUEUE_SIZE - 1);
+
+  if (next == _tail)
+  {
+    _overflows++;
+    return;
+  }
+
+  _edges[head].Time = millis();
+  _edges[head].Pressed = !digitalRead(_pin);
+  _head = next;
+}
+
+void Button::update()
+{
+  while (_tail != _head)
+  {
+    const ButtonEdge &edge = _edges[_tail];
+
+    // the level before this edge held until now, so it may have settled
+    settle(edge.Time);
+    if (edge.Pressed != _raw)
+    {
+      _raw = edge.Pressed;
+      _rawSince = edge.Time;
+    }
+
+    _tail = (_tail + 1) & (BUTTON_QUEUE_SIZE - 1);
+  }
+
+  const uint32_t now = millis();
+
+  // a full ring drops the newest edge, which carries the settled level, and
+  // stalls (ota, a format) fill it; the pin itself is the final word
+  const bool level = !digitalRead(_pin);
+  if (level != _raw && _tail == _head)
+  {
+    settle(now);
+    _raw = level;
+    _rawSince = now;
+  }
+  settle(now);
+
+  if (_pressed)
+  {
+    const uint32_t held = now - _pressedAt;
+
+    if (!_longFired && held >= BUTTON_LONG_PRESS_MS)
+    {
+      // the first click of a click-then-hold stands on its own
+      if (_clickPending)
+      {
+        emit(ButtonEvent::Click, _clickDuration);
+        _clickPending = false;
+      }
+
+      _longFired = true;
+      _nextRepeat = _pressedAt + BUTTON_LONG_PRESS_MS + BUTTON_REPEAT_MS;
+      emit(ButtonEvent::LongPress, held);
+    }
+    else if (_longFired && (int32_t)(now - _nextRepeat) >= 0)
+    {
+      _nextRepeat += BUTTON_REPEAT_MS;
+      emit(ButtonEvent::HoldRepeat, held, ++_repeat);
+    }
+  }
+  else if (_clickPending && now - _clickAt >= BUTTON_DOUBLE_CLICK_MS)
+  {
+    _clickPending = false;
+    emit(ButtonEvent::Click, _clickDuration);
+  }
+}
+
+bool Button::next(ButtonGesture &gesture)
+{
+  if (!_eventCount)
+    return false;
+
+  gesture = _events[_eventHead];
+  _eventHead = (_eventHead + 1) % BUTTON_EVENT_QUEUE_SIZE;
+  _eventCount--;
+  return true;
+}
+
+bool Button::pressed()
+{
+  return _pressed;
+}
+
+uint32_t Button::heldFor()
+{
+  return _pressed ? millis() - _pressedAt : 0;
+}
+
+uint16_t Button::overflows()
+{
+  return _overflows;
+}
+
+void Button::settle(uint32_t time)
+{
+  if (_raw != _pressed && time - _rawSince >= BUTTON_DEBOUNCE_MS)
+    transition(_raw, _rawSince);
+}
+
+void Button::transition(bool pressed, uint32_t time)
+{
+  _pressed = pressed;
+
+  if (pressed)
+  {
+    // a press that starts after the double click window turns the pending click loose
+    if (_clickPending && time - _clickAt >= BUTTON_DOUBLE_CLICK_MS)
+    {
+      _clickPending = false;
+      emit(ButtonEvent::Click, _clickDuration);
+    }
+
+    _pressedAt = time;
+    _longFired = false;
+    _repeat = 0;
+    return;
+  }
+
+  const uint32_t duration = time - _pressedAt;
+
+  if (_longFired)
+    emit(ButtonEvent::LongRelease, duration, _repeat);
+  else if (_clickPending)
+  {
+    _clickPending = false;
+    emit(ButtonEvent::DoubleClick, duration);
+  }
+  else
+  {
+    _clickPending = true;
+    _clickAt = time;
+    _clickDuration = duration;
+  }
+}
+
+void Button::emit(ButtonEvent event, uint32_t duration, uint8_t repeat)
+{
+  // drop the oldest rather than the newest, the latest gesture is what the user is doing now
+  if (_eventCount == BUTTON_EVENT_QUEUE_SIZE)
+  {
+    _eventHead = (_eventHead + 1) % BUTTON_EVENT_QUEUE_SIZE;
+    _eventCount--;
+  }
+
+  ButtonGesture &gesture = _events[(_eventHead + _eventCount) % BUTTON_EVENT_QUEUE_SIZE];
+  gesture.Event = event;
+  gesture.Repeat = repeat;
+  gesture.Duration = duration;
+  _eventCount++;
+}
@@ -0,0 +1,89 @@
+/*
+  Button.h - Debounced push button with gesture events.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _Button_h
+#define _Button_h
+
+#include "Arduino.h"
+
+#define BUTTON_QUEUE_SIZE 16        // edges, power of two
+#define BUTTON_EVENT_QUEUE_SIZE 4
+#define BUTTON_DEBOUNCE_MS 20       // a level must hold this long to count
+#define BUTTON_DOUBLE_CLICK_MS 250  // max gap between the clicks of a double click
+#define BUTTON_LONG_PRESS_MS 500
+#define BUTTON_REPEAT_MS 500        // hold repeat period after the long press
+
+enum class ButtonEvent : uint8_t
+{
+  None = 0,
+  Click = 1,
+  DoubleClick = 2,
+  LongPress = 3,
+  HoldRepeat = 4,
+  LongRelease = 5
+};
+
+struct ButtonGesture
+{
+  ButtonEvent Event;
+  uint8_t Repeat;     // hold repeats so far, HoldRepeat only
+  uint32_t Duration;  // ms the button has been (or was) held
+};
+
+struct ButtonEdge
+{
+  uint32_t Time;
+  bool Pressed;
+};
+
+// The isr only timestamps edges into a single producer, single consumer
+// ring. update() drains it from loop(), debounces on the edge timestamps
+// (so durations are exact to the millisecond however late it runs) and
+// queues gestures for next(). The pin is active low with a pull-up.
+class Button
+{
+public:
+  Button(uint8_t pin);
+
+  void begin(void (*isr)());
+  void edge();
+
+  void update();
+  bool next(ButtonGesture &gesture);
+
+  bool pressed();
+  uint32_t heldFor();
+  uint16_t overflows();
+
+private:
+  void settle(uint32_t time);
+  void transition(bool pressed, uint32_t time);
+  void emit(ButtonEvent event, uint32_t duration, uint8_t repeat = 0);
+
+  uint8_t _pin;
+
+  ButtonEdge _edges[BUTTON_QUEUE_SIZE];
+  volatile uint8_t _head = 0;  // written by the isr
+  volatile uint8_t _tail = 0;  // written by update()
+  volatile uint16_t _overflows = 0;
+
+  ButtonGesture _events[BUTTON_EVENT_QUEUE_SIZE];
+  uint8_t _eventHead = 0;
+  uint8_t _eventCount = 0;
+
+  bool _raw = false;
+  uint32_t _rawSince = 0;
+  bool _pressed = false;
+  uint32_t _pressedAt = 0;
+
+  bool _longFired = false;
+  uint8_t _repeat = 0;
+  uint32_t _nextRepeat = 0;
+
+  bool _clickPending = false;
+  uint32_t _clickAt = 0;
+  uint32_t _clickDuration = 0;
+};
+
+#endif
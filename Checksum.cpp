@@ -0,0 +1,28 @@
+/*
+  Checksum.cpp - CRC-32 (IEEE 802.3) and FNV-1a.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "Checksum.h"
+
+uint32_t Checksum::crc32(const uint8_t *data, size_t length, uint32_t crc)
+{
+  crc = ~crc;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (uint8_t b = 0; b < 8; b++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+uint32_t Checksum::fnv1a(const char *text)
+{
+  uint32_t h = 2166136261UL;
+  while (*text)
+  {
+    h ^= (uint8_t)*text++;
+    h *= 16777619UL;
+  }
+  return h;
+}
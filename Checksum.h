@@ -0,0 +1,20 @@
+/*
+  Checksum.h - CRC-32 (IEEE 802.3) and FNV-1a.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _Checksum_h
+#define _Checksum_h
+
+#include "Arduino.h"
+
+class Checksum
+{
+public:
+  // pass the previous result as crc to checksum data in pieces
+  static uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+  // 32 bit FNV-1a of a string, for hashed name lookups; tools/build_web_assets.py has a copy
+  static uint32_t fnv1a(const char *text);
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+  EventBus.cpp - Fixed size queue of state change events and their subscribers.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "EventBus.h"
+
+bool EventBus::subscribe(EventType type, EventHandler handler)
+{
+  if (_subscriberCount >= EVENT_SUBSCRIBER_LIMIT)
+    return false;
+
+  _subscribers[_subscriberCount].Type = type;
+  _subscribers[_subscriberCount].Handler = handler;
+  _subscriberCount++;
+  return true;
+}
+
+bool EventBus::publish(EventType type, uint8_t value)
+{
+  if (_count >= EVENT_QUEUE_LENGTH)
+  {
+    _dropped++;
+    return false;
+  }
+
+  Event &event = _queue[(_head + _count) % EVENT_QUEUE_LENGTH];
+  event.Type = type;
+  event.Value = value;
+  _count++;
+  return true;
+}
+
+void EventBus::dispatch()
+{
+  for (uint8_t pending = _count; pending; pending--)
+  {
+    const Event event = _queue[_head];
+    _head = (_head + 1) % EVENT_QUEUE_LENGTH;
+    _count--;
+
+    for (uint8_t i = 0; i < _subscriberCount; i++)
+      if (_subscribers[i].Type == event.Type)
+        _subscribers[i].Handler(event);
+  }
+}
+
+uint8_t EventBus::queued()
+{
+  return _count;
+}
+
+uint32_t EventBus::dropped()
+{
+  return _dropped;
+}
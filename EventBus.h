@@ -0,0 +1,61 @@
+/*
+  EventBus.h - Fixed size queue of state change events and their subscribers.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _EventBus_h
+#define _EventBus_h
+
+#include "Arduino.h"
+
+#define EVENT_QUEUE_LENGTH 16
+#define EVENT_SUBSCRIBER_LIMIT 16
+
+enum class EventType : uint8_t
+{
+  AlarmStarted = 0,        // Value: alarm index
+  AlarmEnded = 1,          // Value: alarm index
+  AlarmsChanged = 2,       // alarm table edited or reloaded
+  TorchChanged = 3,        // Value: torch level
+  TimeSynced = 4,          // Value: 1 when the clock is healthy
+  NetworkStateChanged = 5, // Value: WifiState
+};
+
+struct Event
+{
+  EventType Type;
+  uint8_t Value;
+};
+
+typedef void (*EventHandler)(const Event &event);
+
+// Publishers queue an event when their state changes, dispatch() hands the
+// queued events to the subscribers of each type in the order they were
+// published. Nothing is allocated: a full queue drops the new event and
+// counts it. Events published while dispatching wait for the next call.
+// Not for use from interrupts.
+class EventBus
+{
+public:
+  bool subscribe(EventType type, EventHandler handler);
+  bool publish(EventType type, uint8_t value = 0);
+  void dispatch();
+
+  uint8_t queued();
+  uint32_t dropped();
+
+private:
+  struct Subscriber
+  {
+    EventType Type;
+    EventHandler Handler;
+  };
+
+  Event _queue[EVENT_QUEUE_LENGTH];
+  uint8_t _head = 0;
+  uint8_t _count = 0;
+  Subscriber _subscribers[EVENT_SUBSCRIBER_LIMIT];
+  uint8_t _subscriberCount = 0;
+  uint32_t _dropped = 0;
+};
+
+#endif
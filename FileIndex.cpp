@@ -0,0 +1,122 @@
+/*
+  FileIndex.cpp - In-memory index of the files served from SPIFFS.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "FileIndex.h"
+#include "Checksum.h"
+
+struct ContentTypeName
+{
+  const char *Extension;
+  ContentType Type;
+  const char *Mime;
+};
+
+static const ContentTypeName contentTypes[] = {
+    {".html", ContentType::Html, "text/html"},
+    {".htm", ContentType::Html, "text/html"},
+    {".jpg", ContentType::Jpeg, "image/jpeg"},
+    {".jpeg", ContentType::Jpeg, "image/jpeg"},
+    {".png", ContentType::Png, "image/png"},
+    {".js", ContentType::Javascript, "application/javascript"},
+    {".css", ContentType::Css, "text/css"},
+    {".json", ContentType::Json, "application/json"},
+    {".svg", ContentType::Svg, "image/svg+xml"},
+    {".ico", ContentType::Icon, "image/x-icon"},
+};
+
+void FileIndex::clear()
+{
+  _count = 0;
+  _complete = true;
+}
+
+// adds the file or updates its size; false if there was no room for it
+bool FileIndex::update(const char *name, uint32_t size)
+{
+  int8_t i = indexOf(name);
+  if (i < 0)
+  {
+    if (_count == FILE_INDEX_CAPACITY || strlen(name) >= FILE_INDEX_NAME_LENGTH)
+    {
+      _complete = false;
+      return false;
+    }
+
+    i = _count++;
+    strcpy(_entries[i].Name, name);
+    _entries[i].Hash = Checksum::fnv1a(name);
+    _entries[i].Type = typeOf(name);
+  }
+
+  _entries[i].Size = size;
+  return true;
+}
+
+void FileIndex::remove(const char *name)
+{
+  const int8_t i = indexOf(name);
+  if (i < 0)
+    return;
+
+  memmove(&_entries[i], &_entries[i + 1], (_count - i - 1) * sizeof(FileEntry));
+  _count--;
+}
+
+const FileEntry *FileIndex::find(const char *name) const
+{
+  const int8_t i = indexOf(name);
+  return i < 0 ? nullptr : &_entries[i];
+}
+
+bool FileIndex::complete() const
+{
+  return _complete;
+}
+
+uint8_t FileIndex::count() const
+{
+  return _count;
+}
+
+const FileEntry &FileIndex::entry(uint8_t index) const
+{
+  return _entries[index];
+}
+
+ContentType FileIndex::typeOf(const char *name)
+{
+  const size_t length = strlen(name);
+
+  for (const ContentTypeName &type : contentTypes)
+  {
+    const size_t extension = strlen(type.Extension);
+    if (length >= extension && strcmp(name + length - extension, type.Extension) == 0)
+      return type.Type;
+  }
+  return ContentType::None;
+}
+
+// null for ContentType::None, which is sent without a Content-Type
+const char *FileIndex::mimeType(ContentType type)
+{
+  for (const ContentTypeName &entry : contentTypes)
+  {
+    if (entry.Type == type)
+      return entry.Mime;
+  }
+  return nullptr;
+}
+
+// hashes first, so most misses are a compare of one word per entry
+int8_t FileIndex::indexOf(const char *name) const
+{
+  const uint32_t h = Checksum::fnv1a(name);
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_entries[i].Hash == h && strcmp(_entries[i].Name, name) == 0)
+      return i;
+  }
+  return -1;
+}
@@ -0,0 +1,62 @@
+/*
+  FileIndex.h - In-memory index of the files served from SPIFFS.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _FileIndex_h
+#define _FileIndex_h
+
+#include "Arduino.h"
+
+#define FILE_INDEX_CAPACITY 32
+#define FILE_INDEX_NAME_LENGTH 32 // SPIFFS_OBJ_NAME_LEN, terminator included
+
+enum class ContentType : uint8_t
+{
+  None = 0,
+  Html = 1,
+  Jpeg = 2,
+  Png = 3,
+  Javascript = 4,
+  Css = 5,
+  Json = 6,
+  Svg = 7,
+  Icon = 8,
+};
+
+struct FileEntry
+{
+  uint32_t Hash;
+  uint32_t Size;
+  ContentType Type;
+  char Name[FILE_INDEX_NAME_LENGTH];
+};
+
+// A plain container, the owner fills it from SPIFFS and reports every
+// change it makes so lookups never have to touch the filesystem. Entries
+// keep the order they were added in. Once a file is refused for lack of
+// room the index is incomplete: find() misses no longer prove a file is
+// absent and the owner has to ask SPIFFS.
+class FileIndex
+{
+public:
+  void clear();
+  bool update(const char *name, uint32_t size);
+  void remove(const char *name);
+
+  const FileEntry *find(const char *name) const;
+  bool complete() const;
+  uint8_t count() const;
+  const FileEntry &entry(uint8_t index) const;
+
+  static ContentType typeOf(const char *name);
+  static const char *mimeType(ContentType type);
+
+private:
+  int8_t indexOf(const char *name) const;
+
+  FileEntry _entries[FILE_INDEX_CAPACITY];
+  uint8_t _count = 0;
+  bool _complete = true;
+};
+
+#endif
@@ -0,0 +1,188 @@
+/*
+  HeapMonitor.cpp - Heap, fragmentation and stack watermarks with a trend log.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "HeapMonitor.h"
+#include "Log.h"
+
+static uint32_t _allocations = 0;
+static uint32_t _frees = 0;
+static HeapSite _sites[HEAP_SITE_COUNT];
+static uint8_t _siteCount = 0;
+
+#ifdef HEAP_TRACE
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void *__real_realloc(void *ptr, size_t size);
+  void __real_free(void *ptr);
+
+  static void countSite(uint32_t address)
+  {
+    _allocations++;
+
+    for (uint8_t i = 0; i < _siteCount; i++)
+    {
+      if (_sites[i].Address == address)
+      {
+        _sites[i].Count++;
+        return;
+      }
+    }
+
+    // a full table keeps the sites it already has, the total still counts
+    if (_siteCount < HEAP_SITE_COUNT)
+      _sites[_siteCount++] = {address, 1};
+  }
+
+  void *__wrap_malloc(size_t size)
+  {
+    countSite((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_malloc(size);
+  }
+
+  void *__wrap_realloc(void *ptr, size_t size)
+  {
+    countSite((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_realloc(ptr, size);
+  }
+
+  // operator new and new[], so objects are counted where they are created
+  // rather than all at operator new; the core's versions are plain malloc
+  void *__wrap__Znwj(size_t size)
+  {
+    countSite((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_malloc(size);
+  }
+
+  void *__wrap__Znaj(size_t size)
+  {
+    countSite((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_malloc(size);
+  }
+
+  void __wrap_free(void *ptr)
+  {
+    if (ptr)
+      _frees++;
+    __real_free(ptr);
+  }
+}
+#endif
+
+void HeapMonitor::sample()
+{
+  const uint32_t now = millis();
+  uint32_t free;
+  uint16_t largest;
+  uint8_t fragmentation;
+
+  ESP.getHeapStats(&free, &largest, &fragmentation);
+
+  _current.Time = now / 1000;
+  _current.Free = free;
+  _current.LargestBlock = largest;
+  _current.Fragmentation = fragmentation;
+  _current.StackFree = ESP.getFreeContStack(); // already a low watermark, the stack is painted at boot
+
+  if (free < _minFree)
+    _minFree = free;
+  if (largest < _minLargestBlock)
+    _minLargestBlock = largest;
+  if (fragmentation > _maxFragmentation)
+    _maxFragmentation = fragmentation;
+
+  if (!_trendCount || now - _lastTrend >= HEAP_TREND_INTERVAL)
+    record(now);
+}
+
+uint32_t HeapMonitor::freeHeap()
+{
+  return _current.Free;
+}
+
+uint32_t HeapMonitor::largestBlock()
+{
+  return _current.LargestBlock;
+}
+
+uint8_t HeapMonitor::fragmentation()
+{
+  return _current.Fragmentation;
+}
+
+uint32_t HeapMonitor::stackFree()
+{
+  return _current.StackFree;
+}
+
+uint32_t HeapMonitor::minFreeHeap()
+{
+  return _minFree;
+}
+
+uint32_t HeapMonitor::minLargestBlock()
+{
+  return _minLargestBlock;
+}
+
+uint8_t HeapMonitor::maxFragmentation()
+{
+  return _maxFragmentation;
+}
+
+uint8_t HeapMonitor::trendLength()
+{
+  return _trendCount;
+}
+
+// oldest first
+const HeapSample &HeapMonitor::trend(uint8_t index)
+{
+  return _trend[(_trendHead + HEAP_TREND_LENGTH - _trendCount + index) % HEAP_TREND_LENGTH];
+}
+
+bool HeapMonitor::tracing()
+{
+#ifdef HEAP_TRACE
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint32_t HeapMonitor::allocations()
+{
+  return _allocations;
+}
+
+uint32_t HeapMonitor::frees()
+{
+  return _frees;
+}
+
+uint8_t HeapMonitor::siteCount()
+{
+  return _siteCount;
+}
+
+const HeapSite &HeapMonitor::site(uint8_t index)
+{
+  return _sites[index];
+}
+
+void HeapMonitor::record(uint32_t now)
+{
+  const HeapSample *previous = _trendCount ? &trend(_trendCount - 1) : nullptr;
+
+  LOG_INFO("Heap: free %u (%+d), block %u (%+d), frag %u%%, stack %u, allocs %u",
+           _current.Free, previous ? (int32_t)(_current.Free - previous->Free) : 0,
+           _current.LargestBlock, previous ? (int32_t)(_current.LargestBlock - previous->LargestBlock) : 0,
+           _current.Fragmentation, _current.StackFree, _allocations);
+
+  _trend[_trendHead] = _current;
+  _trendHead = (_trendHead + 1) % HEAP_TREND_LENGTH;
+  if (_trendCount < HEAP_TREND_LENGTH)
+    _trendCount++;
+  _lastTrend = now;
+}
@@ -0,0 +1,76 @@
+/*
+  HeapMonitor.h - Heap, fragmentation and stack watermarks with a trend log.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _HeapMonitor_h
+#define _HeapMonitor_h
+
+#include "Arduino.h"
+
+#define HEAP_TREND_INTERVAL 60000  // ms between trend samples
+#define HEAP_TREND_LENGTH 60       // samples kept, an hour at the default interval
+#define HEAP_SITE_COUNT 16
+
+struct HeapSample
+{
+  uint32_t Time;          // s since boot
+  uint32_t Free;
+  uint32_t LargestBlock;
+  uint32_t StackFree;
+  uint8_t Fragmentation;  // %
+};
+
+// Allocation sites are only counted when built with HEAP_TRACE and linked
+// with -Wl,--wrap=malloc,--wrap=realloc,--wrap=free,--wrap=_Znwj,--wrap=_Znaj
+// (platform.local.txt on the device). Sites are return addresses, resolve
+// them with addr2line against the elf. new and new[] are counted at their
+// caller; String grows through realloc inside the core, so every String
+// lands on String::changeBuffer and the table can't tell those apart.
+struct HeapSite
+{
+  uint32_t Address;
+  uint32_t Count;
+};
+
+// sample() reads the allocator's stats and keeps the low watermarks, it
+// walks the free list so it is called about once a second rather than
+// every loop. Every HEAP_TREND_INTERVAL a sample is added to the trend ring
+// and logged.
+class HeapMonitor
+{
+public:
+  void sample();
+
+  uint32_t freeHeap();
+  uint32_t largestBlock();
+  uint8_t fragmentation();
+  uint32_t stackFree();
+
+  uint32_t minFreeHeap();
+  uint32_t minLargestBlock();
+  uint8_t maxFragmentation();
+
+  uint8_t trendLength();
+  const HeapSample &trend(uint8_t index);
+
+  static bool tracing();
+  static uint32_t allocations();
+  static uint32_t frees();
+  static uint8_t siteCount();
+  static const HeapSite &site(uint8_t index);
+
+private:
+  void record(uint32_t now);
+
+  HeapSample _current = {0, 0, 0, 0, 0};
+  uint32_t _minFree = 0xFFFFFFFF;
+  uint32_t _minLargestBlock = 0xFFFFFFFF;
+  uint8_t _maxFragmentation = 0;
+
+  HeapSample _trend[HEAP_TREND_LENGTH];
+  uint8_t _trendHead = 0;
+  uint8_t _trendCount = 0;
+  uint32_t _lastTrend = 0;
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+  LedCompositor.cpp - Layered LED effect compositor.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "Arduino.h"
+#include "LedCompositor.h"
+
+LedCompositor::LedCompositor(uint8_t *output, uint16_t length)
+{
+  _output = output;
+  _length = length;
+
+  for (uint8_t l = 0; l < LED_LAYER_COUNT; l++)
+  {
+    _layers[l] = new uint8_t[length]();
+    _modes[l] = BlendMode::Replace;
+    _alphas[l] = 255;
+  }
+  for (uint8_t l = 0; l < LED_LAYER_COUNT - 1; l++)
+    _accum[l] = new uint8_t[length]();
+}
+
+uint8_t *LedCompositor::edit_layer(const uint8_t layer)
+{
+  invalidate(layer);
+  return _layers[layer];
+}
+
+void LedCompositor::clear(const uint8_t layer)
+{
+  memset(_layers[layer], 0, _length);
+  invalidate(layer);
+}
+
+void LedCompositor::set_mode(const uint8_t layer, const BlendMode mode, const uint8_t alpha)
+{
+  if (_modes[layer] == mode && _alphas[layer] == alpha)
+    return;
+
+  _modes[layer] = mode;
+  _alphas[layer] = alpha;
+  invalidate(layer);
+}
+
+void LedCompositor::set_enabled(const uint8_t layer, const bool enabled)
+{
+  if (is_enabled(layer) == enabled)
+    return;
+
+  if (enabled)
+    _enabled |= (0x01 << layer);
+  else
+    _enabled &= ~(0x01 << layer);
+  invalidate(layer);
+}
+
+bool LedCompositor::is_enabled(const uint8_t layer)
+{
+  return 1 & (_enabled >> layer);
+}
+
+void LedCompositor::invalidate(const uint8_t layer)
+{
+  if (layer < LED_LAYER_COUNT)
+    _dirty |= (0x01 << layer);
+}
+
+bool LedCompositor::compose()
+{
+  if (!_dirty)
+    return false;
+
+  uint8_t first = 0;
+  while (!(1 & (_dirty >> first)))
+    first++;
+
+  const uint8_t *below = first == 0 ? NULL : _accum[first - 1];
+  for (uint8_t l = first; l < LED_LAYER_COUNT; l++)
+  {
+    uint8_t *dst = l == LED_LAYER_COUNT - 1 ? _output : _accum[l];
+    blend(below, l, dst);
+    below = dst;
+  }
+
+  _dirty = 0;
+  return true;
+}
+
+void LedCompositor::blend(const uint8_t *below, const uint8_t layer, uint8_t *dst)
+{
+  const uint8_t *src = _layers[layer];
+
+  if (!is_enabled(layer))
+  {
+    if (below)
+      memcpy(dst, below, _length);
+    else
+      memset(dst, 0, _length);
+    return;
+  }
+
+  if (_modes[layer] == BlendMode::Replace || (!below && _modes[layer] != BlendMode::Alpha))
+  {
+    memcpy(dst, src, _length);
+    return;
+  }
+
+  switch (_modes[layer])
+  {
+  case BlendMode::Add:
+    for (uint16_t i = 0; i < _length; i++)
+    {
+      uint16_t sum = below[i] + src[i];
+      dst[i] = sum > 255 ? 255 : sum;
+    }
+    break;
+
+  case BlendMode::Max:
+    for (uint16_t i = 0; i < _length; i++)
+      dst[i] = src[i] > below[i] ? src[i] : below[i];
+    break;
+
+  case BlendMode::Alpha:
+  {
+    const uint16_t a = _alphas[layer], na = 255 - a;
+    for (uint16_t i = 0; i < _length; i++)
+      dst[i] = (src[i] * a + (below ? below[i] : 0) * na + 127) / 255;
+    break;
+  }
+
+  default:
+    memcpy(dst, src, _length);
+    break;
+  }
+}
@@ -0,0 +1,48 @@
+/*
+  LedCompositor.h - Layered LED effect compositor.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _LedCompositor_h
+#define _LedCompositor_h
+
+#include "Arduino.h"
+
+#define LED_LAYER_COUNT 4
+
+enum class BlendMode : uint8_t
+{
+  Replace = 0,
+  Add = 1,
+  Max = 2,
+  Alpha = 3,
+};
+
+// Each layer owns a buffer the same size as the output. Layers are blended
+// bottom (0) to top; only layers at or above the lowest changed layer are
+// re-blended, the rest come from the cached intermediate result.
+class LedCompositor
+{
+  public:
+            LedCompositor(uint8_t *output, uint16_t length);
+    uint8_t *edit_layer(uint8_t layer);
+    void    clear(uint8_t layer);
+    void    set_mode(uint8_t layer, BlendMode mode, uint8_t alpha = 255);
+    void    set_enabled(uint8_t layer, bool enabled);
+    bool    is_enabled(uint8_t layer);
+    void    invalidate(uint8_t layer);
+    bool    compose();
+
+  private:
+    void    blend(const uint8_t *below, uint8_t layer, uint8_t *dst);
+
+    uint8_t  *_output;
+    uint16_t _length;
+    uint8_t  *_layers[LED_LAYER_COUNT];
+    uint8_t  *_accum[LED_LAYER_COUNT - 1];
+    BlendMode _modes[LED_LAYER_COUNT];
+    uint8_t  _alphas[LED_LAYER_COUNT];
+    uint8_t  _enabled = 0;
+    uint8_t  _dirty = 0;
+};
+
+#endif
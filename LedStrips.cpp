@@ -0,0 +1,151 @@
+/*
+  LedStrips.cpp - Strip layout and bit-parallel output for SK6812 strips.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "Arduino.h"
+#include "LedStrips.h"
+#include "Log.h"
+
+#define GPIO_OFF_ADDR 0x60000308
+
+extern "C" void ICACHE_RAM_ATTR swi_write_planes(const uint8_t *planes, const uint32_t *masks, const uint32_t *runEnds, const uint32_t *runPins, uint8_t runs);
+
+LedStrips::LedStrips(const LedStrip *strips, const uint8_t stripCount, const LedSegment *segments, const uint8_t segmentCount)
+{
+  _strips = strips;
+  _stripCount = stripCount;
+  _segments = segments;
+  _segmentCount = segmentCount;
+}
+
+// leds is the size of the composed buffer the strips and segments must cover
+bool LedStrips::begin(const uint16_t leds)
+{
+  if (_stripCount == 0 || _stripCount > LED_STRIP_MAX)
+  {
+    LOG_ERROR("LED strips: %u configured, %u supported", _stripCount, LED_STRIP_MAX);
+    return false;
+  }
+
+  uint32_t stripLeds = 0, segmentLeds = 0;
+  uint32_t pins = 0;
+  for (uint8_t s = 0; s < _stripCount; s++)
+  {
+    if (_strips[s].Pin > 15)
+    {
+      LOG_ERROR("LED strip %u: GPIO%u can't be driven", s, _strips[s].Pin);
+      return false;
+    }
+    stripLeds += _strips[s].Leds;
+    if (_strips[s].Leds * LED_BYTES_PER_LED > _longest)
+      _longest = _strips[s].Leds * LED_BYTES_PER_LED;
+    pins |= 1UL << _strips[s].Pin;
+  }
+  for (uint8_t z = 0; z < _segmentCount; z++)
+    segmentLeds += _segments[z].Leds;
+
+  if (stripLeds != leds || segmentLeds != leds)
+  {
+    LOG_ERROR("LED strips: %u strip and %u zone LEDs for %u", stripLeds, segmentLeds, leds);
+    return false;
+  }
+
+  // every combination of strips maps to the pins it sets
+  for (uint8_t m = 0; m < (1 << LED_STRIP_MAX); m++)
+  {
+    _masks[m] = 0;
+    for (uint8_t s = 0; s < _stripCount; s++)
+      if (m & (1 << s))
+        _masks[m] |= 1UL << _strips[s].Pin;
+  }
+
+  // one run per distinct strip length, shortest first, each driving the strips at least that long
+  for (uint32_t end = 0;;)
+  {
+    uint32_t next = 0;
+    for (uint8_t s = 0; s < _stripCount; s++)
+    {
+      const uint32_t bits = _strips[s].Leds * LED_BYTES_PER_LED * 8UL;
+      if (bits > end && (!next || bits < next))
+        next = bits;
+    }
+    if (!next)
+      break;
+
+    _runPins[_runs] = 0;
+    for (uint8_t s = 0; s < _stripCount; s++)
+      if (_strips[s].Leds * LED_BYTES_PER_LED * 8UL >= next)
+        _runPins[_runs] |= 1UL << _strips[s].Pin;
+    _runEnds[_runs++] = next;
+    end = next;
+  }
+
+  _planes = new uint8_t[_longest * 4]();
+
+  for (uint8_t s = 0; s < _stripCount; s++)
+    pinMode(_strips[s].Pin, OUTPUT);
+  WRITE_PERI_REG(GPIO_OFF_ADDR, pins);
+  return true;
+}
+
+void LedStrips::prepare(const uint8_t *colours)
+{
+  if (!_planes)
+    return;
+
+  memset(_planes, 0, _longest * 4);
+
+  for (uint8_t s = 0; s < _stripCount; s++)
+  {
+    const uint16_t bytes = _strips[s].Leds * LED_BYTES_PER_LED;
+    uint8_t *plane = _planes;
+
+    // msb first, each pair of bits lands in the high then low nibble of a plane byte
+    for (uint16_t b = 0; b < bytes; b++)
+    {
+      const uint8_t value = *colours++;
+      for (int8_t bit = 7; bit > 0; bit -= 2)
+        *plane++ |= ((value >> bit) & 1) << (4 + s) | ((value >> (bit - 1)) & 1) << s;
+    }
+  }
+}
+
+void LedStrips::write()
+{
+  if (!_planes)
+    return;
+
+  const uint32_t start = ESP.getCycleCount();
+  swi_write_planes(_planes, _masks, _runEnds, _runPins, _runs);
+  _writeTime = (ESP.getCycleCount() - start) / ESP.getCpuFreqMHz();
+}
+
+// ordinal, if given, counts the earlier segments of the same zone
+LedZone LedStrips::zone(const uint16_t led, uint8_t *ordinal)
+{
+  uint16_t first = 0;
+  uint8_t seen[2] = {0, 0};
+
+  for (uint8_t z = 0; z < _segmentCount; z++)
+  {
+    const LedZone zone = _segments[z].Zone;
+    if (led < first + _segments[z].Leds)
+    {
+      if (ordinal)
+        *ordinal = seen[(uint8_t)zone];
+      return zone;
+    }
+    first += _segments[z].Leds;
+    seen[(uint8_t)zone]++;
+  }
+
+  if (ordinal)
+    *ordinal = 0;
+  return LedZone::Outside;
+}
+
+// microseconds the last write() took, which is how long interrupts were locked for
+uint32_t LedStrips::write_time()
+{
+  return _writeTime;
+}
@@ -0,0 +1,65 @@
+/*
+  LedStrips.h - Strip layout and bit-parallel output for SK6812 strips.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _LedStrips_h
+#define _LedStrips_h
+
+#include "Arduino.h"
+
+#define LED_STRIP_MAX 4    // strips sent together, one plane nibble each
+#define LED_BYTES_PER_LED 4 // G, R, B, W
+
+enum class LedZone : uint8_t
+{
+  Inside = 0,
+  Outside = 1,
+};
+
+// One strip on its own data pin (GPIO 0-15). Strips are laid out back to
+// back in the composed colour buffer, in table order.
+struct LedStrip
+{
+  uint8_t Pin;
+  uint16_t Leds;
+};
+
+// A run of LEDs in the composed buffer, counted on from the previous
+// segment; segments may cross strip boundaries.
+struct LedSegment
+{
+  uint16_t Leds;
+  LedZone Zone;
+};
+
+// All strips are clocked out in the same symbol periods. A frame is
+// transposed into bit-planes before interrupts are locked: a nibble per bit
+// time, two to a byte, with a bit set for each strip sending a one. Which
+// strips are still sending follows from their lengths, as runs of bit times
+// worked out in begin(). The locked time is set by the longest strip, not
+// the sum.
+class LedStrips
+{
+  public:
+            LedStrips(const LedStrip *strips, uint8_t stripCount, const LedSegment *segments, uint8_t segmentCount);
+    bool    begin(uint16_t leds);
+    void    prepare(const uint8_t *colours);
+    void    write();
+    LedZone zone(uint16_t led, uint8_t *ordinal = nullptr);
+    uint32_t write_time();
+
+  private:
+    const LedStrip   *_strips;
+    const LedSegment *_segments;
+    uint8_t  _stripCount;
+    uint8_t  _segmentCount;
+    uint16_t _longest = 0;       // bytes in the longest strip
+    uint8_t  *_planes = nullptr; // _longest * 4 bytes, 8 bit times per colour byte
+    uint32_t _masks[1 << LED_STRIP_MAX];
+    uint32_t _runEnds[LED_STRIP_MAX]; // bit time each run stops at
+    uint32_t _runPins[LED_STRIP_MAX]; // pins driven until then
+    uint8_t  _runs = 0;
+    uint32_t _writeTime = 0;
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+  Log.cpp - Levelled log kept as binary records in a RAM ring.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "Log.h"
+
+#define LOG_HEADER_SIZE (6 + sizeof(PGM_P))
+#define LOG_FORMAT_LENGTH 96
+
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+
+// offsets run on from boot, and wrap onto the ring by modulo
+static uint8_t ring[LOG_BUFFER_SIZE];
+static uint32_t head = 0;    // end of the newest record
+static uint32_t tail = 0;    // start of the oldest record still held
+static uint32_t printed = 0; // start of the next record for drain()
+static uint32_t droppedCount = 0;
+
+static const char levelNames[] = " EWID";
+
+uint8_t Log::begin(uint8_t *record, uint8_t level, PGM_P format)
+{
+  const uint32_t now = millis();
+
+  record[1] = level;
+  memcpy(record + 2, &now, 4);
+  memcpy(record + 6, &format, sizeof(format));
+  return LOG_HEADER_SIZE;
+}
+
+bool Log::put(uint8_t *record, uint8_t &length, LogArg tag, const void *value, uint8_t size)
+{
+  if (length + 1 + size > LOG_RECORD_SIZE)
+    return false;
+
+  record[length++] = (uint8_t)tag;
+  memcpy(record + length, value, size);
+  length += size;
+  return true;
+}
+
+bool Log::encodeArg(uint8_t *record, uint8_t &length, const char *value)
+{
+  if (!value)
+    value = "(null)";
+
+  uint8_t size = strnlen(value, LOG_STRING_LENGTH);
+  if (length + 2 + size > LOG_RECORD_SIZE)
+    return false;
+
+  record[length++] = (uint8_t)LogArg::String;
+  record[length++] = size;
+  memcpy(record + length, value, size);
+  length += size;
+  return true;
+}
+
+bool Log::encodeArg(uint8_t *record, uint8_t &length, const String &value)
+{
+  return encodeArg(record, length, value.c_str());
+}
+
+void Log::commit(const uint8_t *record, uint8_t length)
+{
+  // make room by retiring the oldest records whole
+  while (head + length - tail > LOG_BUFFER_SIZE)
+  {
+    if (printed == tail)
+    {
+      printed += ring[tail % LOG_BUFFER_SIZE];
+      droppedCount++;
+    }
+    tail += ring[tail % LOG_BUFFER_SIZE];
+  }
+
+  ring[head % LOG_BUFFER_SIZE] = length;
+  for (uint8_t i = 1; i < length; i++)
+    ring[(head + i) % LOG_BUFFER_SIZE] = record[i];
+  head += length;
+}
+
+uint8_t Log::read(uint32_t offset, uint8_t *record)
+{
+  const uint8_t length = ring[offset % LOG_BUFFER_SIZE];
+
+  for (uint8_t i = 0; i < length; i++)
+    record[i] = ring[(offset + i) % LOG_BUFFER_SIZE];
+  return length;
+}
+
+// Formats a record as "<seconds>.<ms> <level> <message>". Conversions take
+// their value from the record's own tags, so a format that disagrees with
+// its arguments prints wrongly rather than reading garbage; a conversion
+// with no argument left prints '?'.
+uint8_t Log::format(char *line, size_t size, const uint8_t *record)
+{
+  const uint8_t length = record[0];
+  const uint8_t level = record[1] < sizeof(levelNames) - 1 ? record[1] : 0;
+  uint32_t time;
+  PGM_P formatP;
+  char format[LOG_FORMAT_LENGTH];
+
+  memcpy(&time, record + 2, 4);
+  memcpy(&formatP, record + 6, sizeof(formatP));
+  strncpy_P(format, formatP, sizeof(format) - 1);
+  format[sizeof(format) - 1] = 0;
+
+  int used = snprintf(line, size, "%5u.%03u %c ", (unsigned)(time / 1000), (unsigned)(time % 1000), levelNames[level]);
+  uint8_t at = LOG_HEADER_SIZE;
+
+  for (const char *f = format; *f && used < (int)size - 1;)
+  {
+    if (*f != '%')
+    {
+      line[used++] = *f++;
+      continue;
+    }
+    if (f[1] == '%')
+    {
+      line[used++] = '%';
+      f += 2;
+      continue;
+    }
+
+    // copy flags, width and precision, drop length modifiers, keep the conversion
+    char spec[16];
+    uint8_t s = 0;
+    spec[s++] = *f++;
+    while (*f && strchr("-+ #0123456789.", *f) && s < sizeof(spec) - 5)
+      spec[s++] = *f++;
+    while (*f && strchr("hlLqjzt", *f))
+      f++;
+    const char conversion = *f ? *f++ : 'd';
+
+    const int room = size - used;
+    if (at >= length)
+    {
+      line[used++] = '?';
+      continue;
+    }
+
+    const LogArg tag = (LogArg)record[at++];
+    switch (tag)
+    {
+    case LogArg::Int:
+    case LogArg::UInt:
+    {
+      uint32_t v;
+      memcpy(&v, record + at, 4);
+      at += 4;
+      if (conversion == 'c')
+      {
+        spec[s++] = 'c';
+        spec[s] = 0;
+        used += snprintf(line + used, room, spec, (int)v);
+        break;
+      }
+      spec[s++] = 'l';
+      spec[s++] = strchr("diouxX", conversion) ? conversion : 'd';
+      spec[s] = 0;
+      used += tag == LogArg::Int ? snprintf(line + used, room, spec, (long)(int32_t)v) : snprintf(line + used, room, spec, (unsigned long)v);
+      break;
+    }
+    case LogArg::Int64:
+    case LogArg::UInt64:
+    {
+      uint64_t v;
+      memcpy(&v, record + at, 8);
+      at += 8;
+      spec[s++] = 'l';
+      spec[s++] = 'l';
+      spec[s++] = strchr("diouxX", conversion) ? conversion : 'd';
+      spec[s] = 0;
+      used += tag == LogArg::Int64 ? snprintf(line + used, room, spec, (long long)(int64_t)v) : snprintf(line + used, room, spec, (unsigned long long)v);
+      break;
+    }
+    case LogArg::Float:
+    {
+      float v;
+      memcpy(&v, record + at, 4);
+      at += 4;
+      spec[s++] = strchr("eEfgG", conversion) ? conversion : 'g';
+      spec[s] = 0;
+      used += snprintf(line + used, room, spec, (double)v);
+      break;
+    }
+    case LogArg::String:
+    {
+      char v[LOG_STRING_LENGTH + 1];
+      const uint8_t n = record[at++];
+      memcpy(v, record + at, n);
+      v[n] = 0;
+      at += n;
+      spec[s++] = 's';
+      spec[s] = 0;
+      used += snprintf(line + used, room, spec, v);
+      break;
+    }
+    default:
+      at = length; // unknown tag, nothing after it can be trusted
+      line[used++] = '?';
+      break;
+    }
+  }
+
+  if (used > (int)size - 1)
+    used = size - 1;
+  line[used] = 0;
+  return used;
+}
+
+// never waits on the uart: a line is only formatted once the fifo has room for the longest one
+void Log::drain(Print &out)
+{
+  uint8_t record[LOG_RECORD_SIZE];
+  char line[LOG_LINE_LENGTH + 3];
+
+  while (printed != head && out.availableForWrite() >= LOG_LINE_LENGTH + 2)
+  {
+    read(printed, record);
+    uint8_t length = format(line, LOG_LINE_LENGTH + 1, record);
+    line[length++] = '\r';
+    line[length++] = '\n';
+
+    out.write((const uint8_t *)line, length);
+    printed += record[0];
+  }
+}
+
+// prints everything outstanding, waiting on the uart; for just before a restart
+void Log::flush(Print &out)
+{
+  uint8_t record[LOG_RECORD_SIZE];
+  char line[LOG_LINE_LENGTH + 1];
+
+  while (printed != head)
+  {
+    read(printed, record);
+    format(line, sizeof(line), record);
+    out.println(line);
+    printed += record[0];
+  }
+  out.flush();
+}
+
+String Log::dump()
+{
+  static const char hex[] = "0123456789abcdef";
+  String text;
+
+  text.reserve((head - tail) * 2 + 64);
+  for (uint32_t offset = tail; offset != head;)
+  {
+    const uint8_t length = ring[offset % LOG_BUFFER_SIZE];
+    for (uint8_t i = 0; i < length; i++)
+    {
+      const uint8_t b = ring[(offset + i) % LOG_BUFFER_SIZE];
+      text += hex[b >> 4];
+      text += hex[b & 0x0F];
+    }
+    text += '\n';
+    offset += length;
+  }
+  return text;
+}
+
+uint32_t Log::dropped()
+{
+  return droppedCount;
+}
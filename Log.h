@@ -0,0 +1,129 @@
+/*
+  Log.h - Levelled log kept as binary records in a RAM ring.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _Log_h
+#define _Log_h
+
+#include "Arduino.h"
+#include <type_traits>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// messages above this level are compiled out, arguments and all
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_BUFFER_SIZE 2048 // power of two
+#define LOG_RECORD_SIZE 96   // largest record, arguments that don't fit are dropped
+#define LOG_STRING_LENGTH 32 // string arguments are copied, truncated to this
+#define LOG_LINE_LENGTH 120  // formatted line, must fit the uart fifo
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) Log::write(LOG_LEVEL_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) Log::write(LOG_LEVEL_WARN, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) Log::write(LOG_LEVEL_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) Log::write(LOG_LEVEL_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) do {} while (0)
+#endif
+
+enum class LogArg : uint8_t
+{
+  Int = 1,    // 4 bytes
+  UInt = 2,   // 4 bytes
+  Int64 = 3,  // 8 bytes
+  UInt64 = 4, // 8 bytes
+  Float = 5,  // 4 bytes
+  String = 6, // length byte, then the characters
+};
+
+// Record, little endian:
+//   uint8  length   whole record
+//   uint8  level
+//   uint32 time     ms since boot
+//   uint32 format   flash address of the format string (pointer sized)
+//   then per argument a LogArg tag and its value
+// Only the format's address is stored, so logging costs a copy of the
+// arguments and nothing is formatted until the record is printed. Lines
+// have no trailing newline, the drain adds it.
+//
+// drain() prints records to the serial port, as many as fit its fifo
+// without waiting; records overwritten before that are counted as dropped.
+// dump() hex encodes everything still in the ring, one record per line,
+// for tools/log_decode.py to resolve against the elf. Not for use from
+// interrupts.
+class Log
+{
+public:
+  template <typename... Args>
+  static void write(uint8_t level, PGM_P format, const Args &... args)
+  {
+    uint8_t record[LOG_RECORD_SIZE];
+    uint8_t length = begin(record, level, format);
+    encode(record, length, args...);
+    commit(record, length);
+  }
+
+  static void drain(Print &out);
+  static void flush(Print &out);
+  static String dump();
+  static uint32_t dropped();
+
+private:
+  static uint8_t format(char *line, size_t size, const uint8_t *record);
+  static uint8_t begin(uint8_t *record, uint8_t level, PGM_P format);
+  static void commit(const uint8_t *record, uint8_t length);
+  static uint8_t read(uint32_t offset, uint8_t *record);
+  static bool put(uint8_t *record, uint8_t &length, LogArg tag, const void *value, uint8_t size);
+
+  static void encode(uint8_t *record, uint8_t &length) {}
+
+  template <typename T, typename... Rest>
+  static void encode(uint8_t *record, uint8_t &length, const T &value, const Rest &... rest)
+  {
+    if (encodeArg(record, length, value))
+      encode(record, length, rest...);
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value, bool>::type encodeArg(uint8_t *record, uint8_t &length, T value)
+  {
+    if (sizeof(T) > 4)
+    {
+      const uint64_t v = value;
+      return put(record, length, std::is_signed<T>::value ? LogArg::Int64 : LogArg::UInt64, &v, 8);
+    }
+    const uint32_t v = value;
+    return put(record, length, std::is_signed<T>::value ? LogArg::Int : LogArg::UInt, &v, 4);
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_floating_point<T>::value, bool>::type encodeArg(uint8_t *record, uint8_t &length, T value)
+  {
+    const float v = value;
+    return put(record, length, LogArg::Float, &v, 4);
+  }
+
+  static bool encodeArg(uint8_t *record, uint8_t &length, const char *value);
+  static bool encodeArg(uint8_t *record, uint8_t &length, const String &value);
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+  LoopProfiler.cpp - Per-task duration and lateness histograms for the main loop.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "LoopProfiler.h"
+
+uint8_t LoopProfiler::add(const char *name, uint32_t budget)
+{
+  if (_taskCount == PROFILER_TASK_LIMIT)
+    return PROFILER_TASK_LIMIT;
+
+  ProfilerTask &task = _tasks[_taskCount];
+  memset(&task, 0, sizeof(task));
+  task.Name = name;
+  task.Budget = budget;
+  return _taskCount++;
+}
+
+void LoopProfiler::loopStart()
+{
+  _loopStart = ESP.getCycleCount();
+}
+
+void LoopProfiler::loopEnd()
+{
+  const uint32_t us = toMicros(ESP.getCycleCount() - _loopStart);
+
+  _loops++;
+  if (us > _maxLoop)
+    _maxLoop = us;
+}
+
+// lateness is how far past its interval the task started, in us
+void LoopProfiler::record(uint8_t index, uint32_t cycles, uint32_t lateness)
+{
+  if (index >= _taskCount)
+    return;
+
+  ProfilerTask &task = _tasks[index];
+  const uint32_t us = toMicros(cycles);
+
+  task.Runs++;
+  task.TotalDuration += us;
+  task.Duration[bucket(us)]++;
+  task.Lateness[bucket(lateness)]++;
+  if (us > task.MaxDuration)
+    task.MaxDuration = us;
+  if (lateness > task.MaxLateness)
+    task.MaxLateness = lateness;
+
+  if (task.Budget && us > task.Budget)
+  {
+    ProfilerOverrun &overrun = _overruns[_overrunHead];
+    overrun.Time = millis();
+    overrun.Duration = us;
+    overrun.Task = index;
+
+    _overrunHead = (_overrunHead + 1) % PROFILER_OVERRUN_COUNT;
+    if (_overrunCount < PROFILER_OVERRUN_COUNT)
+      _overrunCount++;
+  }
+}
+
+// clears the counters, the registered tasks and their budgets stay
+void LoopProfiler::reset()
+{
+  for (uint8_t i = 0; i < _taskCount; i++)
+  {
+    ProfilerTask &task = _tasks[i];
+    task.Runs = 0;
+    task.MaxDuration = 0;
+    task.MaxLateness = 0;
+    task.TotalDuration = 0;
+    memset(task.Duration, 0, sizeof(task.Duration));
+    memset(task.Lateness, 0, sizeof(task.Lateness));
+  }
+
+  _overrunHead = 0;
+  _overrunCount = 0;
+  _loops = 0;
+  _maxLoop = 0;
+  _lastReset = millis();
+}
+
+uint8_t LoopProfiler::taskCount()
+{
+  return _taskCount;
+}
+
+const ProfilerTask &LoopProfiler::task(uint8_t index)
+{
+  return _tasks[index];
+}
+
+uint8_t LoopProfiler::overrunCount()
+{
+  return _overrunCount;
+}
+
+// oldest first
+const ProfilerOverrun &LoopProfiler::overrun(uint8_t index)
+{
+  return _overruns[(_overrunHead + PROFILER_OVERRUN_COUNT - _overrunCount + index) % PROFILER_OVERRUN_COUNT];
+}
+
+uint32_t LoopProfiler::loops()
+{
+  return _loops;
+}
+
+uint32_t LoopProfiler::maxLoop()
+{
+  return _maxLoop;
+}
+
+uint32_t LoopProfiler::lastReset()
+{
+  return _lastReset;
+}
+
+uint8_t LoopProfiler::bucket(uint32_t us)
+{
+  if (!us)
+    return 0;
+
+  const uint8_t log2 = 31 - __builtin_clz(us);
+  return log2 < PROFILER_BUCKETS ? log2 : PROFILER_BUCKETS - 1;
+}
+
+uint32_t LoopProfiler::toMicros(uint32_t cycles)
+{
+  return cycles / ESP.getCpuFreqMHz();
+}
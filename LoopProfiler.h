@@ -0,0 +1,72 @@
+/*
+  LoopProfiler.h - Per-task duration and lateness histograms for the main loop.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _LoopProfiler_h
+#define _LoopProfiler_h
+
+#include "Arduino.h"
+
+#define PROFILER_TASK_LIMIT 16
+#define PROFILER_BUCKETS 16         // bucket n counts [2^n, 2^(n+1)) us, the last one everything above
+#define PROFILER_OVERRUN_COUNT 16
+
+struct ProfilerTask
+{
+  const char *Name;
+  uint32_t Budget;                // us, longer runs are logged as overruns
+  uint32_t Runs;
+  uint32_t MaxDuration;           // us
+  uint32_t MaxLateness;           // us
+  uint64_t TotalDuration;         // us
+  uint32_t Duration[PROFILER_BUCKETS];
+  uint32_t Lateness[PROFILER_BUCKETS];
+};
+
+struct ProfilerOverrun
+{
+  uint32_t Time;                  // millis() at the end of the run
+  uint32_t Duration;              // us
+  uint8_t Task;
+};
+
+// Timing comes from the cpu cycle counter, so a record costs a handful of
+// cycles plus one division. The counter wraps every ~53s at 80MHz, which
+// no single task or loop pass should come near.
+class LoopProfiler
+{
+public:
+  uint8_t add(const char *name, uint32_t budget);
+
+  void loopStart();
+  void loopEnd();
+  void record(uint8_t task, uint32_t cycles, uint32_t lateness);
+  void reset();
+
+  uint8_t taskCount();
+  const ProfilerTask &task(uint8_t index);
+  uint8_t overrunCount();
+  const ProfilerOverrun &overrun(uint8_t index);
+  uint32_t loops();
+  uint32_t maxLoop();
+  uint32_t lastReset();
+
+  static uint8_t bucket(uint32_t us);
+
+private:
+  uint32_t toMicros(uint32_t cycles);
+
+  ProfilerTask _tasks[PROFILER_TASK_LIMIT];
+  uint8_t _taskCount = 0;
+
+  ProfilerOverrun _overruns[PROFILER_OVERRUN_COUNT];
+  uint8_t _overrunHead = 0;
+  uint8_t _overrunCount = 0;
+
+  uint32_t _loopStart = 0;
+  uint32_t _loops = 0;
+  uint32_t _maxLoop = 0;
+  uint32_t _lastReset = 0;
+};
+
+#endif
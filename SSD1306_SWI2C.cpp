@@ -4,22 +4,11 @@
 */
 #include "Arduino.h"
 #include "SSD1306_SWI2C.h"
+#ifdef SSD1306_USE_WIRE
 #include "Wire.h"
+#endif
 
-int _sda;
-int _scl;
-
-SSD1306::SSD1306(int sda, int scl)
-{
-  _sda = sda;
-  _scl = scl;
-  twi_init();
-  display_init();
-  blank();
-  refresh();
-}
-
-static byte buf[32][16] = {
+const byte SSD1306_LOGO[32][16] = {
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0xE0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x7F, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
@@ -53,151 +42,56 @@ static byte buf[32][16] = {
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0xE0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
 
-void SSD1306::display_init()
+#ifdef SSD1306_USE_WIRE
+void SSD1306_TWI::init(int sda, int scl)
 {
-  twi_start();
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_DISP_OFF);
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_CHARGE_PUMP);
-  twi_send(DATA_CHARGE_PUMP_ON);
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_DISP_ON);
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_CONTRAST);
-  twi_send(0x00);
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_ADDRMODE);
-  twi_send(CMD_ADDRMODE_V);
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_ADDR_HVCOL);
-  twi_send(0x00); //start address
-  twi_send(0x7F); //stop address
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_ADDR_HVPAGE);
-  twi_send(0x00); //start page
-  twi_send(0x07); //stop page
-
-  twi_stop();
+  Wire.begin(sda, scl);
+  Wire.setClock(400000);
 }
 
-void SSD1306::set_pixel(const uint8_t x, const uint8_t y, const bool state)
+// Wire buffers 128 bytes per transmission, so long writes are split and resumed
+void SSD1306_TWI::start(uint8_t address)
 {
-  const auto xb = x / 8, xbn = 7 - (x % 8);
-  if (xb >= 16 || y >= 32)
-    return;
-
-  if (state)
-  {
-    buf[y][xb] |= (0x01 << xbn);
-  }
-  else
-  {
-    buf[y][xb] &= ~(0x01 << xbn);
-  }
+  Wire.beginTransmission(address);
+  this->address = address;
+  sendcount = 0;
 }
 
-void SSD1306::blank()
+void SSD1306_TWI::stop()
 {
-  twi_start();
-  twi_send(CB_DATA);
-  for (int i = 0; i < 1024; i++)
-  {
-    twi_send(0x80);
-  }
-  twi_stop();
+  Wire.endTransmission();
 }
 
-void SSD1306::clear_buffer()
+void SSD1306_TWI::send(byte val)
 {
-  for (uint8_t y = 0; y < 32; y++)
-  {
-    for (uint8_t x = 0; x < 16; x++)
-    {
-      buf[y][x] = 0x00;
-    }
-  }
-}
+  Wire.write(val);
+  sendcount++;
 
-void SSD1306::refresh()
-{
-  twi_start();
-  twi_send(CB_DATA);
-  for (uint8_t x = 0; x < 128; x++)
+  if (sendcount == 128)
   {
-    uint8_t xb = x / 8, xbn = 7 - (x % 8);
-    for (uint8_t y = 0; y < 32; y += 4)
-    {
-      twi_send(0b10101010 | (1 & (buf[y][xb] >> xbn)) | (1 & (buf[y + 1][xb] >> xbn)) << 2 | (1 & (buf[y + 2][xb] >> xbn)) << 4 | (1 & (buf[y + 3][xb] >> xbn)) << 6);
-    }
+    stop();
+    start(address);
+    send(CB_DATA);
   }
-  twi_stop();
 }
-
-void SSD1306::reinitialise()
+#else
+void SSD1306_TWI::init(int sda, int scl)
 {
-  display_init();
+  bus.begin(sda, scl, SSD1306_I2C_FREQUENCY, SSD1306_I2C_CHECK_ACK);
 }
 
-void SSD1306::resynchronize()
+void SSD1306_TWI::start(uint8_t address)
 {
-  twi_start();
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_ADDR_HVCOL);
-  twi_send(0x00); //start address
-  twi_send(0x7F); //stop address
-
-  twi_send(CB_CTRL);
-  twi_send(CMD_ADDR_HVPAGE);
-  twi_send(0x00); //start page
-  twi_send(0x07); //stop page
-
-  twi_stop();
+  bus.beginTransmission(address);
 }
 
-void SSD1306::display_off()
+void SSD1306_TWI::stop()
 {
-  twi_start();
-  twi_send(CB_CTRL);
-  twi_send(CMD_DISP_OFF);
-  twi_stop();
+  bus.endTransmission();
 }
 
-void SSD1306::twi_init()
+void SSD1306_TWI::send(byte val)
 {
-  Wire.begin(_sda, _scl);
-  Wire.setClock(400000);
-}
-
-int sendcount = 0;
-void SSD1306::twi_start()
-{
-  Wire.beginTransmission(ADDR_W);
-  sendcount = 0;
-}
-
-void SSD1306::twi_stop()
-{
-  Wire.endTransmission();
-}
-
-void SSD1306::twi_send(byte val)
-{
-  Wire.write(val);
-  sendcount++;
-
-  if (sendcount == 128)
-  {
-    twi_stop();
-    twi_start();
-    twi_send(CB_DATA);
-  }
+  bus.write(val);
 }
+#endif
@@ -6,6 +6,21 @@
 #define _SSD1306_h
 
 #include "Arduino.h"
+#ifndef SSD1306_USE_WIRE
+#include "SoftI2C.h"
+#endif
+
+// Bus clock for the bit-banged driver, define SSD1306_USE_WIRE to go back to
+// the Wire library at 400kHz. Past 400kHz the module's own pull-ups do the
+// work, SSD1306_I2C_CHECK_ACK 0 saves sampling SDA on every ninth clock.
+// From clock counts a frame should take about 23ms over Wire and 9.5ms at
+// 1MHz; neither is measured on hardware yet, compare displayFrameTime.
+#ifndef SSD1306_I2C_FREQUENCY
+#define SSD1306_I2C_FREQUENCY 1000000
+#endif
+#ifndef SSD1306_I2C_CHECK_ACK
+#define SSD1306_I2C_CHECK_ACK true
+#endif
 
 #define ADDR_W               0b00111100
 #define ADDR_R               0b00111101
@@ -29,27 +44,345 @@
 #define CMD_ADDRMODE_P       0x02
 #define CMD_ADDR_HVCOL       0x21
 #define CMD_ADDR_HVPAGE      0x22
+#define CMD_START_LINE       0x40
+#define CMD_SCROLL_OFF       0x2E
+
+// GDDRAM is 64 rows in 8 pages of 8, and a panel shows every Interleave-th
+// row of it: a 128x64 panel all of them, a 128x32 panel (at the controller's
+// default multiplex and COM settings) only the even rows with start line 0
+// or the odd rows with start line 1. With spare rows refresh() writes the
+// next frame into the hidden ones, rewriting the visible ones unchanged, and
+// then flips with a single start line command, so a frame is never seen half
+// sent. Without them it writes straight to the visible rows.
+
+// One bus, shared by every panel on it; panels pass their address per transaction
+class SSD1306_TWI
+{
+  public:
+    void    init(int sda, int scl);
+    void    start(uint8_t address);
+    void    stop();
+    void    send(byte val);
+
+  private:
+#ifdef SSD1306_USE_WIRE
+    uint8_t address = 0;
+    int     sendcount = 0;
+#else
+    SoftI2C bus;
+#endif
+};
 
+extern const byte SSD1306_LOGO[32][16];
 
-class SSD1306
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+class SSD1306_Panel
 {
+  static_assert(Width % 8 == 0 && Width <= 128, "width must be whole bytes and at most 128 columns");
+  static_assert(Interleave && 8 % Interleave == 0 && Height * Interleave == 64, "height times interleave must cover the 64 GDDRAM rows");
+
   public:
-            SSD1306(int sda, int scl);
+            SSD1306_Panel(SSD1306_TWI &twi);
     void    set_pixel(uint8_t x, uint8_t y, bool state);
     void    clear_buffer();
     void    blank();
     void    refresh();
+    void    refresh_columns(uint8_t x0, uint8_t x1);
+    void    set_clip(uint8_t x0, uint8_t x1);
     void    reinitialise();
     void    resynchronize();
     void    display_off();
-    
+    uint32_t frame_time();
+
   private:
-    void    twi_init();
+    static const uint8_t Stride = Width / 8;            // buffer bytes per row
+    static const uint8_t RowsPerPage = 8 / Interleave; // panel rows per GDDRAM page byte
+
     void    twi_start();
     void    twi_stop();
     void    twi_send(byte val);
     void    display_init();
+    void    set_window(uint8_t x0, uint8_t x1, uint8_t page0);
+    void    flip(uint8_t parity);
+
+    static uint8_t column_bits(const byte (*b)[Stride], uint8_t x, uint8_t y);
+    static uint8_t every_parity(uint8_t bits);
+
+    SSD1306_TWI &twi;
+    byte    buf[Height][Stride];
+    byte    front[Height][Stride]; // what the panel currently shows
+    uint8_t visible = 0;           // row parity on screen, which is also the start line
+    uint8_t clipX0 = 0, clipX1 = Width - 1; // columns set_pixel may change
+    uint32_t frameTime = 0;
 };
 
-#endif
+// the panel on the alarm itself
+typedef SSD1306_Panel<128, 32, ADDR_W, 2> SSD1306;
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+SSD1306_Panel<Width, Height, Address, Interleave>::SSD1306_Panel(SSD1306_TWI &twi) : twi(twi)
+{
+  display_init();
+  blank();
+
+  // boot logo, centred on panels tall enough for it
+  clear_buffer();
+  if (Width >= 128 && Height >= 32)
+    for (uint8_t y = 0; y < 32; y++)
+      memcpy(buf[y + (Height - 32) / 2], SSD1306_LOGO[y], 16);
+  refresh();
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::set_window(uint8_t x0, uint8_t x1, uint8_t page0)
+{
+  twi_start();
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDR_HVCOL);
+  twi_send(x0); //start address
+  twi_send(x1); //stop address
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDR_HVPAGE);
+  twi_send(page0); //start page
+  twi_send(0x07);  //stop page
+
+  twi_stop();
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::flip(uint8_t parity)
+{
+  twi_start();
+  twi_send(CB_CTRL);
+  twi_send(CMD_START_LINE | parity);
+  twi_stop();
+
+  visible = parity;
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::display_init()
+{
+  twi_start();
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_DISP_OFF);
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_CHARGE_PUMP);
+  twi_send(DATA_CHARGE_PUMP_ON);
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_DISP_ON);
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_CONTRAST);
+  twi_send(0x00);
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDRMODE);
+  twi_send(CMD_ADDRMODE_V);
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDR_HVCOL);
+  twi_send(0x00);      //start address
+  twi_send(Width - 1); //stop address
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDR_HVPAGE);
+  twi_send(0x00); //start page
+  twi_send(0x07); //stop page
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_SCROLL_OFF);
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_START_LINE | visible);
+
+  twi_stop();
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::set_pixel(const uint8_t x, const uint8_t y, const bool state)
+{
+  const auto xb = x / 8, xbn = 7 - (x % 8);
+  if (x < clipX0 || x > clipX1 || y >= Height)
+    return;
 
+  if (state)
+  {
+    buf[y][xb] |= (0x01 << xbn);
+  }
+  else
+  {
+    buf[y][xb] &= ~(0x01 << xbn);
+  }
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::blank()
+{
+  set_window(0, Width - 1, 0);
+
+  twi_start();
+  twi_send(CB_DATA);
+  for (int i = 0; i < Width * 8; i++)
+  {
+    twi_send(0x00);
+  }
+  twi_stop();
+
+  memset(front, 0, sizeof(front));
+  flip(0);
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::clear_buffer()
+{
+  memset(buf, 0, sizeof(buf));
+}
+
+// one page worth of rows of one column, spread onto the parity 0 bits of a page byte
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+inline uint8_t SSD1306_Panel<Width, Height, Address, Interleave>::column_bits(const byte (*b)[Stride], uint8_t x, uint8_t y)
+{
+  const uint8_t xb = x / 8, xbn = 7 - (x % 8);
+  uint8_t bits = 0;
+  for (uint8_t i = 0; i < RowsPerPage; i++)
+    bits |= (1 & (b[y + i][xb] >> xbn)) << (i * Interleave);
+  return bits;
+}
+
+// copies parity 0 bits into every parity, so a flip doesn't change them
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+inline uint8_t SSD1306_Panel<Width, Height, Address, Interleave>::every_parity(uint8_t bits)
+{
+  return bits * ((1 << Interleave) - 1);
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::refresh()
+{
+  const uint8_t hidden = (visible + 1) % Interleave;
+  const uint32_t start = micros();
+
+  set_window(0, Width - 1, 0);
+
+  twi_start();
+  twi_send(CB_DATA);
+  for (uint8_t x = 0; x < Width; x++)
+  {
+    for (uint8_t y = 0; y < Height; y += RowsPerPage)
+    {
+      if (Interleave == 1)
+        twi_send(column_bits(buf, x, y));
+      else
+        twi_send(column_bits(buf, x, y) << hidden | column_bits(front, x, y) << visible);
+    }
+  }
+  twi_stop();
+
+  if (Interleave > 1)
+    flip(hidden);
+  frameTime = micros() - start;
+  memcpy(front, buf, sizeof(buf));
+}
+
+// pushes columns x0..x1 only, into every parity; small enough that a flip isn't worth it
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::refresh_columns(uint8_t x0, uint8_t x1)
+{
+  if (x1 > Width - 1)
+    x1 = Width - 1;
+  if (x0 > x1)
+    return;
+
+  set_window(x0, x1, 0);
+
+  twi_start();
+  twi_send(CB_DATA);
+  for (uint8_t x = x0; x <= x1; x++)
+  {
+    uint8_t xb = x / 8, mask = 0x80 >> (x % 8);
+    for (uint8_t y = 0; y < Height; y += RowsPerPage)
+    {
+      twi_send(every_parity(column_bits(buf, x, y)));
+
+      for (uint8_t row = y; row < y + RowsPerPage; row++)
+        front[row][xb] = (front[row][xb] & ~mask) | (buf[row][xb] & mask);
+    }
+  }
+  twi_stop();
+
+}
+
+// limits set_pixel to columns x0..x1, so text can be drawn into part of a line;
+// set_clip(0, Width - 1) lifts it
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::set_clip(uint8_t x0, uint8_t x1)
+{
+  clipX0 = x0;
+  clipX1 = x1 < Width - 1 ? x1 : Width - 1;
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::reinitialise()
+{
+  display_init();
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::resynchronize()
+{
+  twi_start();
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDR_HVCOL);
+  twi_send(0x00);      //start address
+  twi_send(Width - 1); //stop address
+
+  twi_send(CB_CTRL);
+  twi_send(CMD_ADDR_HVPAGE);
+  twi_send(0x00); //start page
+  twi_send(0x07); //stop page
+
+  twi_stop();
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+void SSD1306_Panel<Width, Height, Address, Interleave>::display_off()
+{
+  twi_start();
+  twi_send(CB_CTRL);
+  twi_send(CMD_DISP_OFF);
+  twi_stop();
+}
+
+// microseconds taken by the last full refresh(), flip included
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+uint32_t SSD1306_Panel<Width, Height, Address, Interleave>::frame_time()
+{
+  return frameTime;
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+inline void SSD1306_Panel<Width, Height, Address, Interleave>::twi_start()
+{
+  twi.start(Address);
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+inline void SSD1306_Panel<Width, Height, Address, Interleave>::twi_stop()
+{
+  twi.stop();
+}
+
+template <uint8_t Width, uint8_t Height, uint8_t Address, uint8_t Interleave>
+inline void SSD1306_Panel<Width, Height, Address, Interleave>::twi_send(byte val)
+{
+  twi.send(val);
+}
+
+#endif
@@ -1,38 +1,54 @@
 #include "SSD1306_Utils.h"
 #include "Arduino.h"
 
-uint8_t SSD1306_Utils::write_char(SSD1306* screen, const uint8_t x, const uint8_t y, Font* f, const char c)
+// dst holds SSD1306_UTILS_PRINTF_BUFFER bytes, longer output is truncated
+uint8_t SSD1306_Utils::format_vprintf(char* dst, const char* format, va_list args)
 {
-  const auto w = f->getCharWidth(c),
-    h = f->getCharHeight(c),
-    gap = f->getCharGap(c),
-    drop = f->getCharDrop(c);
-  const auto xi = f->getCharDataStartOffset(c),
-    yi = f->getCharDataRowOffset(c);
-
-  for (uint8_t cx = 0; cx < w + gap; cx++)
-    for (uint8_t cy = 0; cy < h + gap + drop; cy++)
-    {
-      if (cx >= w || cy >= h + drop || cy < drop || c == 32)
-      {
-        // blank space
-        screen->set_pixel(x + cx, y + cy, false);
-      }
-      else
-      {
-        const auto byte_num = ((yi * (cy - drop)) + xi + cx) / 8;
-        const auto bit_num = 7 - (((yi * cy) + xi + cx) % 8);
-        screen->set_pixel(x + cx, y + cy, 0x01 & (f->getByte(byte_num) >> bit_num));
-      }
-    }
-  return w + gap;
+  int length = vsnprintf(dst, SSD1306_UTILS_PRINTF_BUFFER, format, args);
+
+  if (length < 0)
+    return 0;
+  if (length >= SSD1306_UTILS_PRINTF_BUFFER)
+    length = SSD1306_UTILS_PRINTF_BUFFER - 1; // truncated
+  return length;
+}
+
+// dst holds at least 11 bytes
+uint8_t SSD1306_Utils::format_int(char* dst, const int32_t value)
+{
+  uint8_t length = 0;
+
+  if (value < 0)
+    dst[length++] = '-';
+  return length + format_uint(dst + length, value < 0 ? -(uint32_t)value : value);
 }
 
-void SSD1306_Utils::write_string(SSD1306* screen, uint8_t x, const uint8_t y, Font* f, String str)
+// dst holds at least 15 bytes
+uint8_t SSD1306_Utils::format_ip(char* dst, const IPAddress& ip)
 {
-  for (auto i : str)
+  uint8_t length = 0;
+
+  for (uint8_t i = 0; i < 4; i++)
   {
-    const auto shift = write_char(screen, x, y, f, i);
-    x += shift;
+    if (i)
+      dst[length++] = '.';
+    length += format_uint(dst + length, ip[i]);
   }
+  return length;
+}
+
+uint8_t SSD1306_Utils::format_uint(char* dst, uint32_t value)
+{
+  char digits[10];
+  uint8_t count = 0;
+
+  do
+  {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  for (uint8_t i = 0; i < count; i++)
+    dst[i] = digits[count - 1 - i];
+  return count;
 }
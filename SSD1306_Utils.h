@@ -5,11 +5,110 @@
 #include "SSD1306_SWI2C.h"
 #include "Font.h"
 
+#define SSD1306_UTILS_PRINTF_BUFFER 32 // wider than a line of the smallest font
+
+// write_* return the x just past the last glyph so calls can be chained.
+// They take any SSD1306_Panel, so they live here; the formatting they
+// share is in the .cpp.
 class SSD1306_Utils
 {
   public:
-    static uint8_t write_char(SSD1306* screen, uint8_t x, uint8_t y, Font* f, char c);
-    static void write_string(SSD1306* screen, uint8_t x, uint8_t y, Font* f, String str);
+    template <class Panel> static uint8_t write_char(Panel* screen, uint8_t x, uint8_t y, Font* f, char c);
+    template <class Panel> static uint8_t write_string(Panel* screen, uint8_t x, uint8_t y, Font* f, const char* str);
+    template <class Panel> static uint8_t write_string(Panel* screen, uint8_t x, uint8_t y, Font* f, const char* str, size_t length);
+    template <class Panel> static uint8_t write_string(Panel* screen, uint8_t x, uint8_t y, Font* f, const String& str);
+    template <class Panel> static uint8_t write_printf(Panel* screen, uint8_t x, uint8_t y, Font* f, const char* format, ...) __attribute__((format(printf, 5, 6)));
+    template <class Panel> static uint8_t write_int(Panel* screen, uint8_t x, uint8_t y, Font* f, int32_t value, uint8_t width = 0);
+    template <class Panel> static uint8_t write_ip(Panel* screen, uint8_t x, uint8_t y, Font* f, const IPAddress& ip);
+
+  private:
+    static uint8_t format_uint(char* dst, uint32_t value);
+    static uint8_t format_int(char* dst, int32_t value);
+    static uint8_t format_ip(char* dst, const IPAddress& ip);
+    static uint8_t format_vprintf(char* dst, const char* format, va_list args);
 };
 
+template <class Panel>
+uint8_t SSD1306_Utils::write_char(Panel* screen, const uint8_t x, const uint8_t y, Font* f, const char c)
+{
+  const auto w = f->getCharWidth(c),
+    h = f->getCharHeight(c),
+    gap = f->getCharGap(c),
+    drop = f->getCharDrop(c);
+  const auto xi = f->getCharDataStartOffset(c),
+    yi = f->getCharDataRowOffset(c);
+
+  for (uint8_t cx = 0; cx < w + gap; cx++)
+    for (uint8_t cy = 0; cy < h + gap + drop; cy++)
+    {
+      if (cx >= w || cy >= h + drop || cy < drop || c == 32)
+      {
+        // blank space
+        screen->set_pixel(x + cx, y + cy, false);
+      }
+      else
+      {
+        const auto byte_num = ((yi * (cy - drop)) + xi + cx) / 8;
+        const auto bit_num = 7 - (((yi * cy) + xi + cx) % 8);
+        screen->set_pixel(x + cx, y + cy, 0x01 & (f->getByte(byte_num) >> bit_num));
+      }
+    }
+  return w + gap;
+}
+
+template <class Panel>
+uint8_t SSD1306_Utils::write_string(Panel* screen, uint8_t x, const uint8_t y, Font* f, const char* str)
+{
+  while (*str)
+    x += write_char(screen, x, y, f, *str++);
+  return x;
+}
+
+template <class Panel>
+uint8_t SSD1306_Utils::write_string(Panel* screen, uint8_t x, const uint8_t y, Font* f, const char* str, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+    x += write_char(screen, x, y, f, str[i]);
+  return x;
+}
+
+template <class Panel>
+uint8_t SSD1306_Utils::write_string(Panel* screen, const uint8_t x, const uint8_t y, Font* f, const String& str)
+{
+  return write_string(screen, x, y, f, str.c_str(), str.length());
+}
+
+template <class Panel>
+uint8_t SSD1306_Utils::write_printf(Panel* screen, const uint8_t x, const uint8_t y, Font* f, const char* format, ...)
+{
+  char text[SSD1306_UTILS_PRINTF_BUFFER];
+  va_list args;
+
+  va_start(args, format);
+  const uint8_t length = format_vprintf(text, format, args);
+  va_end(args);
+
+  return write_string(screen, x, y, f, text, length);
+}
+
+// pads with trailing spaces up to width characters, so a shorter number clears a longer one
+template <class Panel>
+uint8_t SSD1306_Utils::write_int(Panel* screen, uint8_t x, const uint8_t y, Font* f, const int32_t value, const uint8_t width)
+{
+  char text[12];
+  uint8_t length = format_int(text, value);
+
+  x = write_string(screen, x, y, f, text, length);
+  for (; length < width; length++)
+    x += write_char(screen, x, y, f, ' ');
+  return x;
+}
+
+template <class Panel>
+uint8_t SSD1306_Utils::write_ip(Panel* screen, const uint8_t x, const uint8_t y, Font* f, const IPAddress& ip)
+{
+  char text[16];
+  return write_string(screen, x, y, f, text, format_ip(text, ip));
+}
+
 #endif
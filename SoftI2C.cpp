@@ -0,0 +1,93 @@
+/*
+  SoftI2C.cpp - Bit-banged write-only I2C master on the GPIO registers.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "SoftI2C.h"
+
+void SoftI2C::begin(uint8_t sda, uint8_t scl, uint32_t frequency, bool checkAck)
+{
+  _sda = 1UL << sda;
+  _scl = 1UL << scl;
+  _checkAck = checkAck;
+
+  // round up so the bus never runs faster than asked
+  const uint32_t cycles = ESP.getCpuFreqMHz() * 1000000UL;
+  _halfPeriod = (cycles + frequency * 2 - 1) / (frequency * 2);
+
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _sda | _scl);
+  pinMode(sda, OUTPUT_OPEN_DRAIN);
+  pinMode(scl, OUTPUT);
+  _edge = ESP.getCycleCount();
+}
+
+void SoftI2C::beginTransmission(uint8_t address)
+{
+  _acked = true;
+
+  // start: sda falls while scl is high
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _sda);
+  wait();
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _scl);
+  wait();
+  WRITE_PERI_REG(SOFTI2C_GPIO_CLEAR, _sda);
+  wait();
+  WRITE_PERI_REG(SOFTI2C_GPIO_CLEAR, _scl);
+
+  sendByte(address << 1);
+}
+
+bool SoftI2C::write(uint8_t value)
+{
+  sendByte(value);
+  return _acked;
+}
+
+void SoftI2C::write(const uint8_t *data, size_t length)
+{
+  while (length--)
+    sendByte(*data++);
+}
+
+// true when every byte since beginTransmission() was acknowledged, or acks aren't checked
+bool SoftI2C::endTransmission()
+{
+  // stop: sda rises while scl is high
+  WRITE_PERI_REG(SOFTI2C_GPIO_CLEAR, _sda);
+  wait();
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _scl);
+  wait();
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _sda);
+  wait();
+
+  return _acked;
+}
+
+void SoftI2C::sendByte(uint8_t value)
+{
+  for (uint8_t mask = 0x80; mask; mask >>= 1)
+  {
+    WRITE_PERI_REG(value & mask ? SOFTI2C_GPIO_SET : SOFTI2C_GPIO_CLEAR, _sda);
+    wait();
+    WRITE_PERI_REG(SOFTI2C_GPIO_SET, _scl);
+    wait();
+    WRITE_PERI_REG(SOFTI2C_GPIO_CLEAR, _scl);
+  }
+
+  // ninth clock, sda released for the slave's ack
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _sda);
+  wait();
+  WRITE_PERI_REG(SOFTI2C_GPIO_SET, _scl);
+  wait();
+  if (_checkAck && (READ_PERI_REG(SOFTI2C_GPIO_IN) & _sda))
+    _acked = false;
+  WRITE_PERI_REG(SOFTI2C_GPIO_CLEAR, _scl);
+}
+
+// holds each half period from the previous edge, so time spent between calls counts towards it
+inline void SoftI2C::wait()
+{
+  uint32_t now;
+  while ((now = ESP.getCycleCount()) - _edge < _halfPeriod)
+    ;
+  _edge = now;
+}
@@ -0,0 +1,43 @@
+/*
+  SoftI2C.h - Bit-banged write-only I2C master on the GPIO registers.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _SoftI2C_h
+#define _SoftI2C_h
+
+#include "Arduino.h"
+#include "eagle_soc.h"
+
+#define SOFTI2C_GPIO_SET 0x60000304
+#define SOFTI2C_GPIO_CLEAR 0x60000308
+#define SOFTI2C_GPIO_IN 0x60000318
+
+// A master for write-only slaves like the SSD1306, which never stretch the
+// clock: SCL is driven push-pull for sharp edges, SDA is open drain so the
+// slave can pull it low to acknowledge. Transactions have no length limit.
+// With ack checks off the ninth clock is sent without sampling SDA, and a
+// missing slave goes unnoticed. Pins must be GPIO0-15; above ~400kHz SDA
+// relies on the module's own pull-ups (~4.7k), not the weak internal ones.
+class SoftI2C
+{
+public:
+  void begin(uint8_t sda, uint8_t scl, uint32_t frequency, bool checkAck = true);
+
+  void beginTransmission(uint8_t address);
+  bool write(uint8_t value);
+  void write(const uint8_t *data, size_t length);
+  bool endTransmission();
+
+private:
+  void sendByte(uint8_t value);
+  void wait();
+
+  uint32_t _sda = 0;    // pin masks
+  uint32_t _scl = 0;
+  uint32_t _halfPeriod = 0; // cycles
+  uint32_t _edge = 0;
+  bool _checkAck = true;
+  bool _acked = true;
+};
+
+#endif
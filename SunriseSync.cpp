@@ -0,0 +1,203 @@
+/*
+  SunriseSync.cpp - Keeps alarms on several units in step over UDP multicast.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "SunriseSync.h"
+#include <ESP8266WiFi.h>
+#include "Checksum.h"
+#include "Log.h"
+
+SunriseSync::SunriseSync(WiFiUDP &udp)
+    : _udp(udp)
+{
+}
+
+void SunriseSync::begin(uint32_t unit)
+{
+  _unit = unit;
+}
+
+// alarm is null while idle. Returns the ms to add to the local alarm's
+// elapsed time, a bounded slice of the offset to the leader per call.
+int32_t SunriseSync::update(bool online, const SyncAlarm *alarm)
+{
+  const uint32_t now = millis();
+
+  if (!online)
+  {
+    if (_joined)
+      _udp.stop();
+    _joined = false;
+    reset();
+    return 0;
+  }
+
+  if (!_joined)
+  {
+    _joined = _udp.beginMulticast(WiFi.localIP(), IPAddress(SYNC_GROUP), SYNC_PORT);
+    if (!_joined)
+      return 0;
+    _lastSlew = now;
+  }
+
+  if (!alarm)
+  {
+    // keep the socket drained, nothing to follow
+    while (_udp.parsePacket() > 0)
+      ;
+    reset();
+    return 0;
+  }
+
+  if (alarm->Epoch != _epoch)
+  {
+    reset();
+    _epoch = alarm->Epoch;
+    _lastSent = now; // listen for a leader before offering to lead
+  }
+
+  receive(*alarm, now);
+
+  if (_leader && now - _lastHeard > SYNC_TIMEOUT)
+  {
+    LOG_INFO("Sync: leader %08x lost, leading", _leader);
+    _leader = 0;
+    _pending = 0;
+  }
+
+  if (!_leader && now - _lastSent >= SYNC_INTERVAL)
+  {
+    send(*alarm);
+    _lastSent = now;
+  }
+
+  const uint32_t interval = now - _lastSlew;
+  _lastSlew = now;
+  if (!_pending)
+    return 0;
+
+  int32_t correction = _pending;
+  if (correction <= SYNC_STEP_MS && correction >= -SYNC_STEP_MS)
+  {
+    int32_t limit = interval * SYNC_SLEW_MS_PER_S / 1000;
+    if (limit < 1)
+      limit = 1;
+    correction = constrain(correction, -limit, limit);
+  }
+  if (correction < 0 && (uint32_t)-correction > alarm->Elapsed)
+    correction = -(int32_t)alarm->Elapsed;
+
+  _pending -= correction;
+  return correction;
+}
+
+void SunriseSync::receive(const SyncAlarm &alarm, uint32_t now)
+{
+  uint8_t packet[SYNC_PACKET_SIZE];
+
+  while (_udp.parsePacket() > 0)
+  {
+    if (_udp.available() != SYNC_PACKET_SIZE || _udp.read(packet, SYNC_PACKET_SIZE) != SYNC_PACKET_SIZE)
+      continue;
+    if (packet[0] != (SYNC_MAGIC & 0xFF) || packet[1] != (SYNC_MAGIC >> 8) || packet[2] != SYNC_VERSION)
+      continue;
+    if (readU32(packet + 24) != Checksum::crc32(packet, 24))
+      continue;
+
+    // our own packets loop back; higher ids follow us
+    const uint32_t unit = readU32(packet + 4);
+    if (unit >= _unit || (_leader && unit > _leader))
+      continue;
+    if (packet[3] != (uint8_t)alarm.Curve || readU32(packet + 12) != alarm.Epoch || readU32(packet + 20) != alarm.Length)
+      continue;
+
+    const uint32_t sequence = readU32(packet + 8);
+    if (unit == _leader)
+    {
+      if ((int32_t)(sequence - _leaderSequence) <= 0)
+        continue; // duplicate or reordered
+      _lost += sequence - _leaderSequence - 1;
+    }
+    else
+    {
+      LOG_INFO("Sync: following %08x", unit);
+      _leader = unit;
+    }
+
+    _leaderSequence = sequence;
+    _lastHeard = now;
+    _received++;
+
+    _offset = (int32_t)(readU32(packet + 16) - alarm.Elapsed);
+    _pending = _offset;
+  }
+}
+
+void SunriseSync::send(const SyncAlarm &alarm)
+{
+  uint8_t packet[SYNC_PACKET_SIZE];
+
+  packet[0] = SYNC_MAGIC & 0xFF;
+  packet[1] = SYNC_MAGIC >> 8;
+  packet[2] = SYNC_VERSION;
+  packet[3] = (uint8_t)alarm.Curve;
+  writeU32(packet + 4, _unit);
+  writeU32(packet + 8, ++_sequence);
+  writeU32(packet + 12, alarm.Epoch);
+  writeU32(packet + 16, alarm.Elapsed);
+  writeU32(packet + 20, alarm.Length);
+  writeU32(packet + 24, Checksum::crc32(packet, 24));
+
+  if (_udp.beginPacketMulticast(IPAddress(SYNC_GROUP), SYNC_PORT, WiFi.localIP()) && _udp.write(packet, SYNC_PACKET_SIZE) == SYNC_PACKET_SIZE && _udp.endPacket())
+    _sent++;
+}
+
+void SunriseSync::reset()
+{
+  _epoch = 0;
+  _leader = 0;
+  _leaderSequence = 0;
+  _pending = 0;
+  _offset = 0;
+}
+
+bool SunriseSync::leading()
+{
+  return _joined && _epoch && !_leader;
+}
+
+uint32_t SunriseSync::leader()
+{
+  return _leader;
+}
+
+int32_t SunriseSync::offset()
+{
+  return _offset;
+}
+
+uint32_t SunriseSync::sent()
+{
+  return _sent;
+}
+
+uint32_t SunriseSync::received()
+{
+  return _received;
+}
+
+uint32_t SunriseSync::lost()
+{
+  return _lost;
+}
+
+void SunriseSync::writeU32(uint8_t *dst, uint32_t value)
+{
+  for (uint8_t i = 0; i < 4; i++)
+    dst[i] = value >> (8 * i);
+}
+
+uint32_t SunriseSync::readU32(const uint8_t *src)
+{
+  return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
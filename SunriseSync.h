@@ -0,0 +1,99 @@
+/*
+  SunriseSync.h - Keeps alarms on several units in step over UDP multicast.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _SunriseSync_h
+#define _SunriseSync_h
+
+#include "Arduino.h"
+#include <WiFiUdp.h>
+
+// override at build time to run several units on one host
+#ifndef SYNC_GROUP
+#define SYNC_GROUP 239, 255, 83, 82
+#endif
+#ifndef SYNC_PORT
+#define SYNC_PORT 4210
+#endif
+
+#define SYNC_MAGIC 0x5253 // "SR"
+#define SYNC_VERSION 1
+#define SYNC_PACKET_SIZE 28
+#define SYNC_INTERVAL 1000     // ms between packets while leading
+#define SYNC_TIMEOUT 3500      // ms without a packet before the leader is dropped
+#define SYNC_STEP_MS 30000     // offsets beyond this jump instead of slewing
+#define SYNC_SLEW_MS_PER_S 100 // 10%, a sunrise colour lasts two minutes
+
+enum class SyncCurve : uint8_t
+{
+  None = 0,
+  Flash = 1,
+  Sunrise = 2
+};
+
+// What the local unit is running. Units only follow a leader running the
+// same curve from the same start epoch, so they must share the alarm.
+struct SyncAlarm
+{
+  uint32_t Epoch;   // utc seconds the alarm was scheduled to start
+  SyncCurve Curve;
+  uint32_t Elapsed; // ms into the alarm
+  uint32_t Length;  // ms
+};
+
+// Packet, little endian, SYNC_PACKET_SIZE bytes:
+//   uint16 magic, uint8 version, uint8 curve
+//   uint32 unit, uint32 sequence
+//   uint32 epoch, uint32 elapsed, uint32 length
+//   uint32 crc32 of everything before it
+//
+// Every alarming unit listens on the group; the lowest unit id running a
+// given alarm leads and sends its position once a second, the others take
+// the offset to it and slew towards it. A follower that stops hearing its
+// leader takes over. Packets older than the last one from the same unit
+// are dropped, gaps in the sequence are counted as lost. Nothing in the
+// tree drives several instances against each other; checking convergence
+// needs two or more units, or host builds, on one group.
+class SunriseSync
+{
+public:
+  SunriseSync(WiFiUDP &udp);
+
+  void begin(uint32_t unit);
+  int32_t update(bool online, const SyncAlarm *alarm);
+
+  bool leading();
+  uint32_t leader();
+  int32_t offset();
+  uint32_t sent();
+  uint32_t received();
+  uint32_t lost();
+
+private:
+  void receive(const SyncAlarm &alarm, uint32_t now);
+  void send(const SyncAlarm &alarm);
+  void reset();
+
+  static void writeU32(uint8_t *dst, uint32_t value);
+  static uint32_t readU32(const uint8_t *src);
+
+  WiFiUDP &_udp;
+  uint32_t _unit = 0;
+  bool _joined = false;
+
+  uint32_t _epoch = 0;        // alarm being followed
+  uint32_t _leader = 0;       // 0 while leading or idle
+  uint32_t _leaderSequence = 0;
+  uint32_t _lastHeard = 0;
+  int32_t _pending = 0;       // ms still to be slewed
+  int32_t _offset = 0;        // leader minus local at the last packet
+  uint32_t _lastSlew = 0;
+
+  uint32_t _sequence = 0;
+  uint32_t _lastSent = 0;
+  uint32_t _sent = 0;
+  uint32_t _received = 0;
+  uint32_t _lost = 0;
+};
+
+#endif
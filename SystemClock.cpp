@@ -0,0 +1,351 @@
+/*
+  SystemClock.cpp - Local clock disciplined by asynchronous NTP exchanges.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "SystemClock.h"
+#include "Checksum.h"
+
+extern "C"
+{
+#include "user_interface.h"
+}
+
+SystemClock::SystemClock(WiFiUDP &udp, const char *server, TimeZone &zone)
+    : _udp(udp), _zone(zone)
+{
+  _server = server;
+}
+
+bool SystemClock::restore()
+{
+  if (loadRtc() || loadFlash())
+  {
+    refreshLocal(utcMicros() / 1000000ULL);
+    return true;
+  }
+
+  return false;
+}
+
+void SystemClock::begin()
+{
+  _udp.begin(NTP_LOCAL_PORT);
+  _nextPoll = micros64();
+}
+
+bool SystemClock::update(bool online)
+{
+  const uint64_t now = micros64();
+
+  // offline the request would only stall on dns, so just hold the schedule
+  if (_waiting)
+    receiveReply();
+  else if (now >= _nextPoll && online)
+    sendRequest();
+
+  const uint32_t utc = utcMicros() / 1000000ULL;
+  if (utc == _lastSecond)
+    return false;
+
+  refreshLocal(utc);
+
+  if (_source != ClockSource::None)
+    saveRtc();
+  // a step in either direction also makes the checkpoint due
+  if (_source != ClockSource::None && utc - _lastFlash >= CLOCK_FLASH_INTERVAL)
+    saveFlash();
+
+  return true;
+}
+
+void SystemClock::invalidateLocal()
+{
+  _lastSecond = 0xFFFFFFFF;
+}
+
+const LocalTime &SystemClock::local()
+{
+  return _local;
+}
+
+uint64_t SystemClock::utcMicros()
+{
+  const int64_t elapsed = micros64() - _baseMicros;
+  return _baseUtc + elapsed + (elapsed * _drift) / 1000000000LL;
+}
+
+bool SystemClock::synced()
+{
+  return _synced;
+}
+
+// rtc or ntp; a flash checkpoint is behind by the power cut plus up to CLOCK_FLASH_INTERVAL
+bool SystemClock::trusted()
+{
+  return _source >= ClockSource::Rtc;
+}
+
+ClockSource SystemClock::source()
+{
+  return _source;
+}
+
+bool SystemClock::healthy()
+{
+  return _synced && _failures < CLOCK_FAILURE_LIMIT;
+}
+
+uint32_t SystemClock::pollInterval()
+{
+  return 1UL << _pollExponent;
+}
+
+int32_t SystemClock::drift()
+{
+  return _drift;
+}
+
+int32_t SystemClock::lastOffset()
+{
+  return _lastOffset;
+}
+
+uint32_t SystemClock::lastDelay()
+{
+  return _lastDelay;
+}
+
+uint32_t SystemClock::requests()
+{
+  return _requests;
+}
+
+uint8_t SystemClock::failures()
+{
+  return _failures;
+}
+
+void SystemClock::sendRequest()
+{
+  uint8_t packet[NTP_PACKET_SIZE];
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = 0b11100011; // LI unsynchronised, version 4, mode 3 (client)
+
+  // the server echoes our transmit timestamp as its originate timestamp
+  _sentUtc = utcMicros();
+  writeTimestamp(packet + 40, _sentUtc);
+
+  while (_udp.parsePacket() > 0)
+    ; // each call skips the rest of the previous packet, drop anything stale
+
+  _requests++;
+  if (!_udp.beginPacket(_server, NTP_PORT) || _udp.write(packet, NTP_PACKET_SIZE) != NTP_PACKET_SIZE || !_udp.endPacket())
+  {
+    fail();
+    return;
+  }
+
+  _sentMicros = micros64();
+  _waiting = true;
+}
+
+void SystemClock::receiveReply()
+{
+  const uint64_t now = micros64();
+
+  if (_udp.parsePacket() < NTP_PACKET_SIZE)
+  {
+    if (now - _sentMicros > CLOCK_TIMEOUT_US)
+      fail();
+    return;
+  }
+
+  const int64_t t4 = utcMicros();
+  uint8_t packet[NTP_PACKET_SIZE];
+  _udp.read(packet, NTP_PACKET_SIZE);
+
+  uint8_t sent[8];
+  writeTimestamp(sent, _sentUtc);
+  const uint8_t mode = packet[0] & 0x07, stratum = packet[1];
+  if (memcmp(sent, packet + 24, 8) != 0 || mode != 4 || stratum == 0 || stratum > 15)
+  {
+    // not ours, or a kiss-o'-death; keep waiting until the timeout
+    return;
+  }
+
+  const int64_t t1 = _sentUtc;
+  const int64_t t2 = readTimestamp(packet + 32);
+  const int64_t t3 = readTimestamp(packet + 40);
+
+  const int64_t delay = (t4 - t1) - (t3 - t2);
+  const int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+  _waiting = false;
+  if (delay < 0 || delay > CLOCK_MAX_DELAY_US)
+  {
+    fail();
+    return;
+  }
+
+  _lastDelay = delay;
+  discipline(offset, now);
+}
+
+void SystemClock::discipline(int64_t offset, int64_t now)
+{
+  const int64_t sinceBase = now - _baseMicros;
+  const int64_t current = utcMicros();
+  const int64_t magnitude = offset < 0 ? -offset : offset;
+
+  if (_synced && magnitude < CLOCK_STEP_US && sinceBase > 0)
+  {
+    // frequency lock: the residual offset over the interval is the remaining drift, apply a quarter of it
+    int64_t drift = _drift + (offset * 1000000000LL / sinceBase) / 4;
+    if (drift > CLOCK_MAX_DRIFT_PPB)
+      drift = CLOCK_MAX_DRIFT_PPB;
+    if (drift < -CLOCK_MAX_DRIFT_PPB)
+      drift = -CLOCK_MAX_DRIFT_PPB;
+    _drift = drift;
+
+    if (magnitude < CLOCK_STABLE_US && _pollExponent < CLOCK_POLL_MAX)
+      _pollExponent++;
+  }
+  else if (_synced)
+  {
+    // large step after being synced, something changed; poll harder until it settles
+    _pollExponent = CLOCK_POLL_MIN;
+  }
+
+  _baseMicros = now;
+  _baseUtc = current + offset;
+  _lastOffset = offset;
+  _synced = true;
+  _source = ClockSource::Ntp;
+  _failures = 0;
+  _nextPoll = now + ((uint64_t)1000000 << _pollExponent);
+  _lastSecond = 0xFFFFFFFF;
+}
+
+void SystemClock::fail()
+{
+  _waiting = false;
+  if (_failures < 0xFF)
+    _failures++;
+
+  // retry quickly at first, backing off to the regular poll interval
+  uint8_t exponent = CLOCK_POLL_MIN + _failures - 1;
+  if (exponent > _pollExponent)
+    exponent = _pollExponent;
+  _nextPoll = micros64() + ((uint64_t)1000000 << exponent);
+}
+
+void SystemClock::refreshLocal(uint32_t utc)
+{
+  const uint32_t epoch = _zone.toLocal(utc);
+  const uint32_t secondOfDay = epoch % 86400UL;
+
+  _lastSecond = utc;
+  _local.Utc = utc;
+  _local.Epoch = epoch;
+  _local.Hours = secondOfDay / 3600;
+  _local.Minutes = (secondOfDay / 60) % 60;
+  _local.Seconds = secondOfDay % 60;
+  _local.Day = ((epoch / 86400UL) + 4) % 7; // 1970-01-01 was a thursday
+}
+
+void SystemClock::checkpoint(ClockCheckpoint &point)
+{
+  point.Utc = utcMicros();
+  point.RtcTicks = system_get_rtc_time();
+  point.Magic = CLOCK_RTC_MAGIC;
+  point.Drift = _drift;
+  point.Crc = Checksum::crc32((uint8_t *)&point, offsetof(ClockCheckpoint, Crc));
+}
+
+void SystemClock::saveRtc()
+{
+  ClockCheckpoint point;
+  checkpoint(point);
+  ESP.rtcUserMemoryWrite(CLOCK_RTC_OFFSET, (uint32_t *)&point, sizeof(point));
+}
+
+void SystemClock::saveFlash()
+{
+  ClockCheckpoint point;
+  checkpoint(point);
+
+  // a torn write fails the crc and is ignored on the next boot
+  auto f = SPIFFS.open(CLOCK_FILE_NAME, "w");
+  if (f)
+  {
+    f.write((uint8_t *)&point, sizeof(point));
+    f.close();
+  }
+
+  _lastFlash = point.Utc / 1000000ULL;
+}
+
+bool SystemClock::loadRtc()
+{
+  // power-on and the reset pin clear the rtc timer, the memory may survive but the ticks are meaningless
+  const uint32_t reason = ESP.getResetInfoPtr()->reason;
+  if (reason == REASON_DEFAULT_RST || reason == REASON_EXT_SYS_RST)
+    return false;
+
+  ClockCheckpoint point;
+  if (!ESP.rtcUserMemoryRead(CLOCK_RTC_OFFSET, (uint32_t *)&point, sizeof(point)) ||
+      point.Magic != CLOCK_RTC_MAGIC || point.Crc != Checksum::crc32((uint8_t *)&point, offsetof(ClockCheckpoint, Crc)))
+    return false;
+
+  // calibration is microseconds per tick in q12
+  const uint64_t ticks = (uint32_t)(system_get_rtc_time() - point.RtcTicks);
+  seed(point.Utc + ((ticks * system_rtc_clock_cali_proc()) >> 12), point.Drift, ClockSource::Rtc);
+  return true;
+}
+
+bool SystemClock::loadFlash()
+{
+  ClockCheckpoint point;
+  auto f = SPIFFS.open(CLOCK_FILE_NAME, "r");
+  if (!f)
+    return false;
+
+  const size_t length = f.read((uint8_t *)&point, sizeof(point));
+  f.close();
+  if (length != sizeof(point) || point.Magic != CLOCK_RTC_MAGIC ||
+      point.Crc != Checksum::crc32((uint8_t *)&point, offsetof(ClockCheckpoint, Crc)))
+    return false;
+
+  _lastFlash = point.Utc / 1000000ULL;
+  seed(point.Utc, point.Drift, ClockSource::Flash);
+  return true;
+}
+
+void SystemClock::seed(uint64_t utc, int32_t drift, ClockSource source)
+{
+  _baseMicros = micros64();
+  _baseUtc = utc;
+  _drift = drift;
+  _source = source;
+  _lastSecond = 0xFFFFFFFF;
+}
+
+uint64_t SystemClock::readTimestamp(const uint8_t *src)
+{
+  const uint32_t seconds = (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | src[3];
+  const uint32_t fraction = (uint32_t)src[4] << 24 | (uint32_t)src[5] << 16 | (uint32_t)src[6] << 8 | src[7];
+
+  return (uint64_t)(seconds - NTP_UNIX_OFFSET) * 1000000ULL + (((uint64_t)fraction * 1000000ULL) >> 32);
+}
+
+void SystemClock::writeTimestamp(uint8_t *dst, uint64_t micros)
+{
+  const uint32_t seconds = micros / 1000000ULL + NTP_UNIX_OFFSET;
+  const uint32_t fraction = ((micros % 1000000ULL) << 32) / 1000000ULL;
+
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    dst[i] = seconds >> (24 - i * 8);
+    dst[i + 4] = fraction >> (24 - i * 8);
+  }
+}
@@ -0,0 +1,136 @@
+/*
+  SystemClock.h - Local clock disciplined by asynchronous NTP exchanges.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _SystemClock_h
+#define _SystemClock_h
+
+#include "Arduino.h"
+#include <WiFiUdp.h>
+#include <FS.h>
+#include "TimeZone.h"
+
+#define NTP_PORT 123
+#define NTP_LOCAL_PORT 1337
+#define NTP_PACKET_SIZE 48
+#define NTP_UNIX_OFFSET 2208988800UL
+
+#define CLOCK_TIMEOUT_US 1000000LL      // give up on a reply after 1s
+#define CLOCK_MAX_DELAY_US 250000LL     // samples with a longer round trip are too noisy to use
+#define CLOCK_STEP_US 128000LL          // offsets beyond this step the clock instead of slewing
+#define CLOCK_STABLE_US 50000LL         // offsets within this lengthen the poll interval
+#define CLOCK_MAX_DRIFT_PPB 500000L
+#define CLOCK_POLL_MIN 4                // 2^4 = 16s
+#define CLOCK_POLL_MAX 14               // 2^14 = ~4.5h
+#define CLOCK_FAILURE_LIMIT 3
+
+// rtc user memory blocks, after the wifi cache
+#ifndef CLOCK_RTC_OFFSET
+#define CLOCK_RTC_OFFSET 40
+#endif
+#define CLOCK_RTC_MAGIC 0x434C4B31      // "CLK1"
+#define CLOCK_FILE_NAME "sys_clock.bin"
+#define CLOCK_FLASH_INTERVAL 900UL      // s between flash checkpoints, bounds how stale a power cut leaves the clock
+
+enum class ClockSource : uint8_t
+{
+  None = 0,   // never set, reads 1970
+  Flash = 1,  // last flash checkpoint, behind by the power cut plus up to CLOCK_FLASH_INTERVAL
+  Rtc = 2,    // rtc checkpoint carried across a reset by the rtc timer
+  Ntp = 3
+};
+
+// Written to rtc memory every second and to flash every 15 minutes. The rtc
+// timer keeps counting through soft resets, watchdog resets and deep sleep,
+// so the ticks since a checkpoint give the time spent rebooting.
+struct ClockCheckpoint
+{
+  uint64_t Utc;       // utc micros
+  uint32_t Magic;
+  uint32_t RtcTicks;  // system_get_rtc_time() at Utc
+  int32_t Drift;
+  uint32_t Crc;
+};
+
+struct LocalTime
+{
+  uint32_t Utc;    // utc seconds since 1970
+  uint32_t Epoch;  // local seconds since 1970
+  uint8_t Hours;
+  uint8_t Minutes;
+  uint8_t Seconds;
+  uint8_t Day;     // 0 = sunday
+};
+
+// Time is answered from micros64() scaled by a drift estimate and rebased
+// on every accepted NTP sample. Requests never block: update() sends a
+// request when the poll interval has elapsed and picks up the reply on a
+// later call. The broken-down local time is recomputed once per second.
+// restore() seeds the clock at boot from the newest checkpoint so the
+// display and alarms run before the network is up.
+class SystemClock
+{
+public:
+  SystemClock(WiFiUDP &udp, const char *server, TimeZone &zone);
+
+  bool restore();
+  void begin();
+  bool update(bool online);
+  void invalidateLocal();
+
+  const LocalTime &local();
+  uint64_t utcMicros();
+  bool synced();
+  bool trusted();
+  ClockSource source();
+  bool healthy();
+
+  uint32_t pollInterval();
+  int32_t drift();
+  int32_t lastOffset();
+  uint32_t lastDelay();
+  uint32_t requests();
+  uint8_t failures();
+
+private:
+  void sendRequest();
+  void receiveReply();
+  void discipline(int64_t offset, int64_t now);
+  void fail();
+  void refreshLocal(uint32_t utc);
+  void checkpoint(ClockCheckpoint &point);
+  void saveRtc();
+  void saveFlash();
+  bool loadRtc();
+  bool loadFlash();
+  void seed(uint64_t utc, int32_t drift, ClockSource source);
+
+  static uint64_t readTimestamp(const uint8_t *src);
+  static void writeTimestamp(uint8_t *dst, uint64_t micros);
+
+  WiFiUDP &_udp;
+  const char *_server;
+  TimeZone &_zone;
+
+  uint64_t _baseMicros = 0;  // micros64() at the last rebase
+  uint64_t _baseUtc = 0;     // utc micros at the last rebase
+  int32_t _drift = 0;        // ppb, positive when the local oscillator runs slow
+
+  bool _synced = false;
+  ClockSource _source = ClockSource::None;
+  uint32_t _lastFlash = 0;   // utc seconds
+  bool _waiting = false;
+  uint64_t _sentMicros = 0;
+  uint64_t _sentUtc = 0;
+  uint64_t _nextPoll = 0;
+  uint8_t _pollExponent = CLOCK_POLL_MIN;
+  uint8_t _failures = 0;
+  int32_t _lastOffset = 0;
+  uint32_t _lastDelay = 0;
+  uint32_t _requests = 0;
+
+  uint32_t _lastSecond = 0xFFFFFFFF;
+  LocalTime _local = {0, 0, 0, 0, 0, 4};
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+  TimeZone.cpp - POSIX TZ string rules with a cached next transition.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "TimeZone.h"
+
+TimeZone::TimeZone()
+{
+  parse("UTC0");
+}
+
+bool TimeZone::parse(const char *spec)
+{
+  if (!spec || strlen(spec) >= TZ_SPEC_LENGTH)
+    return false;
+
+  int32_t stdOffset, dstOffset;
+  bool hasDst = false;
+  // without a rule POSIX leaves it implementation defined, use the same default as glibc
+  Rule start = {'M', 3, 2, 0, 0, TZ_DEFAULT_RULE_TIME};
+  Rule end = {'M', 11, 1, 0, 0, TZ_DEFAULT_RULE_TIME};
+
+  const char *p = parseName(spec);
+  if (!p || !(p = parseOffset(p, stdOffset)))
+    return false;
+  stdOffset = -stdOffset;
+  dstOffset = stdOffset + 3600;
+
+  if (*p)
+  {
+    if (!(p = parseName(p)))
+      return false;
+    hasDst = true;
+
+    if (*p && *p != ',')
+    {
+      if (!(p = parseOffset(p, dstOffset)))
+        return false;
+      dstOffset = -dstOffset;
+    }
+
+    if (*p == ',')
+    {
+      if (!(p = parseRule(p + 1, start)) || *p != ',' || !(p = parseRule(p + 1, end)))
+        return false;
+    }
+  }
+
+  if (*p)
+    return false;
+
+  strcpy(_spec, spec);
+  _stdOffset = stdOffset;
+  _dstOffset = dstOffset;
+  _hasDst = hasDst;
+  _start = start;
+  _end = end;
+
+  // force the next toLocal() to recompute the window
+  _windowStart = 1;
+  _windowEnd = 0;
+  return true;
+}
+
+const char *TimeZone::spec()
+{
+  return _spec;
+}
+
+uint32_t TimeZone::toLocal(uint32_t utc)
+{
+  if (utc < _windowStart || utc >= _windowEnd)
+    prepare(utc);
+
+  return utc + _current;
+}
+
+uint32_t TimeZone::toUtc(uint32_t local)
+{
+  const uint32_t asStd = local - _stdOffset;
+  if (!_hasDst)
+    return asStd;
+
+  const uint32_t asDst = local - _dstOffset;
+  const bool stdValid = offsetAt(asStd) == _stdOffset;
+  const bool dstValid = offsetAt(asDst) == _dstOffset;
+
+  if (stdValid && dstValid)
+    return asStd < asDst ? asStd : asDst;
+  if (dstValid)
+    return asDst;
+  return asStd;
+}
+
+int32_t TimeZone::offsetAt(uint32_t utc)
+{
+  if (utc >= _windowStart && utc < _windowEnd)
+    return _current;
+
+  int64_t previous, next;
+  return _hasDst && dstAt(utc, previous, next) ? _dstOffset : _stdOffset;
+}
+
+bool TimeZone::hasDst()
+{
+  return _hasDst;
+}
+
+bool TimeZone::isDst()
+{
+  return _currentDst;
+}
+
+int32_t TimeZone::currentOffset()
+{
+  return _current;
+}
+
+uint32_t TimeZone::nextTransition()
+{
+  return _windowEnd;
+}
+
+void TimeZone::prepare(uint32_t utc)
+{
+  if (!_hasDst)
+  {
+    _current = _stdOffset;
+    _currentDst = false;
+    _windowStart = 0;
+    _windowEnd = 0xFFFFFFFF;
+    return;
+  }
+
+  int64_t previous, next;
+  _currentDst = dstAt(utc, previous, next);
+  _current = _currentDst ? _dstOffset : _stdOffset;
+  _windowStart = previous < 0 ? 0 : previous;
+  _windowEnd = next > 0xFFFFFFFFLL ? 0xFFFFFFFF : next;
+}
+
+bool TimeZone::dstAt(int64_t utc, int64_t &previous, int64_t &next)
+{
+  const int32_t year = yearFromDays(utc / 86400);
+
+  // transitions of the surrounding years, so windows spanning new year resolve too
+  bool dst = false;
+  previous = 0;
+  next = 0xFFFFFFFFLL;
+  for (int32_t y = year - 1; y <= year + 1; y++)
+  {
+    const int64_t start = transition(_start, y, _stdOffset);
+    const int64_t end = transition(_end, y, _dstOffset);
+
+    if (start <= utc && start >= previous)
+    {
+      previous = start;
+      dst = true;
+    }
+    if (end <= utc && end >= previous)
+    {
+      previous = end;
+      dst = false;
+    }
+    if (start > utc && start < next)
+      next = start;
+    if (end > utc && end < next)
+      next = end;
+  }
+
+  return dst;
+}
+
+int64_t TimeZone::transition(const Rule &rule, int32_t year, int32_t offset)
+{
+  const int32_t jan1 = daysFromCivil(year, 1, 1);
+  const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  int32_t day;
+
+  switch (rule.Type)
+  {
+  case 'J': // 1-365, february 29th is never counted
+    day = jan1 + rule.Day - 1 + (leap && rule.Day >= 60 ? 1 : 0);
+    break;
+
+  case 'D': // 0-365, february 29th counts
+    day = jan1 + rule.Day;
+    break;
+
+  default: // week w (5 = last) of month m, weekday d
+  {
+    const int32_t first = daysFromCivil(year, rule.Month, 1);
+    const int32_t nextMonth = rule.Month == 12 ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, rule.Month + 1, 1);
+    const uint8_t firstWeekday = (first + 4) % 7;
+
+    day = first + (rule.Weekday + 7 - firstWeekday) % 7 + (rule.Week - 1) * 7;
+    while (day >= nextMonth)
+      day -= 7;
+    break;
+  }
+  }
+
+  // rule times are local wall time in the offset in effect before the transition
+  return (int64_t)day * 86400 + rule.Time - offset;
+}
+
+int32_t TimeZone::daysFromCivil(int32_t year, uint8_t month, uint8_t day)
+{
+  year -= month <= 2;
+  const int32_t era = (year >= 0 ? year : year - 399) / 400;
+  const uint32_t yoe = year - era * 400;
+  const uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+int32_t TimeZone::yearFromDays(int32_t days)
+{
+  days += 719468;
+  const int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const uint32_t doe = days - era * 146097;
+  const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const uint32_t mp = (5 * doy + 2) / 153;
+  return (int32_t)yoe + era * 400 + (mp >= 10 ? 1 : 0);
+}
+
+const char *TimeZone::parseName(const char *p)
+{
+  if (*p == '<')
+  {
+    const char *close = strchr(p, '>');
+    return close && close - p >= 4 ? close + 1 : NULL;
+  }
+
+  const char *start = p;
+  while (isalpha(*p))
+    p++;
+  return p - start >= 3 ? p : NULL;
+}
+
+const char *TimeZone::parseOffset(const char *p, int32_t &seconds)
+{
+  int32_t sign = 1, hours = 0, minutes = 0, secs = 0;
+  if (*p == '+' || *p == '-')
+    sign = *p++ == '-' ? -1 : 1;
+
+  if (!(p = parseNumber(p, hours, 167)))
+    return NULL;
+  if (*p == ':' && !(p = parseNumber(p + 1, minutes, 59)))
+    return NULL;
+  if (*p == ':' && !(p = parseNumber(p + 1, secs, 59)))
+    return NULL;
+
+  seconds = sign * (hours * 3600 + minutes * 60 + secs);
+  return p;
+}
+
+const char *TimeZone::parseRule(const char *p, Rule &rule)
+{
+  int32_t a, b, c;
+  rule.Time = TZ_DEFAULT_RULE_TIME;
+
+  if (*p == 'M')
+  {
+    if (!(p = parseNumber(p + 1, a, 12)) || a < 1 || *p != '.'
+      || !(p = parseNumber(p + 1, b, 5)) || b < 1 || *p != '.'
+      || !(p = parseNumber(p + 1, c, 6)))
+      return NULL;
+    rule.Type = 'M';
+    rule.Month = a;
+    rule.Week = b;
+    rule.Weekday = c;
+  }
+  else if (*p == 'J')
+  {
+    if (!(p = parseNumber(p + 1, a, 365)) || a < 1)
+      return NULL;
+    rule.Type = 'J';
+    rule.Day = a;
+  }
+  else
+  {
+    if (!(p = parseNumber(p, a, 365)))
+      return NULL;
+    rule.Type = 'D';
+    rule.Day = a;
+  }
+
+  if (*p == '/' && !(p = parseOffset(p + 1, rule.Time)))
+    return NULL;
+
+  return p;
+}
+
+const char *TimeZone::parseNumber(const char *p, int32_t &value, int32_t max)
+{
+  if (!isdigit(*p))
+    return NULL;
+
+  value = 0;
+  while (isdigit(*p))
+  {
+    value = value * 10 + (*p++ - '0');
+    if (value > max)
+      return NULL;
+  }
+  return p;
+}
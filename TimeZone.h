@@ -0,0 +1,72 @@
+/*
+  TimeZone.h - POSIX TZ string rules with a cached next transition.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _TimeZone_h
+#define _TimeZone_h
+
+#include "Arduino.h"
+
+#define TZ_SPEC_LENGTH 48
+#define TZ_DEFAULT_RULE_TIME 7200 // transitions happen at 02:00 unless the rule says otherwise
+
+// Parses "std offset [dst [offset] [,start[/time],end[/time]]]", e.g.
+// "SAST-2", "CET-1CEST,M3.5.0,M10.5.0/3" or "<+10>-10". Dates may be
+// Mm.w.d, Jn or n. Offsets in the spec are west of UTC, as POSIX has them;
+// everything this class returns is seconds east of UTC.
+class TimeZone
+{
+public:
+  TimeZone();
+
+  bool parse(const char *spec);
+  const char *spec();
+
+  // hot path: a comparison against the cached transition window plus an add
+  uint32_t toLocal(uint32_t utc);
+  // nonexistent local times (spring forward) resolve to after the gap, ambiguous ones to the first occurrence
+  uint32_t toUtc(uint32_t local);
+
+  int32_t offsetAt(uint32_t utc);
+  bool hasDst();
+  bool isDst();
+  int32_t currentOffset();
+  uint32_t nextTransition();
+
+  static int32_t daysFromCivil(int32_t year, uint8_t month, uint8_t day);
+  static int32_t yearFromDays(int32_t days);
+
+private:
+  struct Rule
+  {
+    char Type; // 'M', 'J' or 'D' (zero based day of year)
+    uint8_t Month;
+    uint8_t Week;
+    uint8_t Weekday;
+    uint16_t Day;
+    int32_t Time;
+  };
+
+  void prepare(uint32_t utc);
+  bool dstAt(int64_t utc, int64_t &previous, int64_t &next);
+  int64_t transition(const Rule &rule, int32_t year, int32_t offset);
+
+  static const char *parseName(const char *p);
+  static const char *parseOffset(const char *p, int32_t &seconds);
+  static const char *parseRule(const char *p, Rule &rule);
+  static const char *parseNumber(const char *p, int32_t &value, int32_t max);
+
+  char _spec[TZ_SPEC_LENGTH];
+  int32_t _stdOffset;
+  int32_t _dstOffset;
+  bool _hasDst;
+  Rule _start;
+  Rule _end;
+
+  uint32_t _windowStart = 1;
+  uint32_t _windowEnd = 0;
+  int32_t _current = 0;
+  bool _currentDst = false;
+};
+
+#endif
@@ -8,9 +8,16 @@
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
 #include <FS.h>
+#include "FileIndex.h"
 
 #define WEBSERVER_FILE_BUFFER_LENGTH 128
 #define READ_TIMEOUT 500
+#define WEBSERVER_FILE_LIST_PAGE 16
+
+// time an async api handler may run for per handle() call
+#ifndef WEBSERVER_SLICE_US
+#define WEBSERVER_SLICE_US 10000
+#endif
 
 enum class ErrorState : uint8_t
 {
@@ -22,6 +29,7 @@ enum class ErrorState : uint8_t
   Conflict = 5,
   NotFound = 6,
   InternalServerError = 7,
+  PreconditionFailed = 8,
 };
 
 enum class ResponseType : uint8_t
@@ -31,20 +39,53 @@ enum class ResponseType : uint8_t
   Text = 2
 };
 
+// a file compiled in by tools/build_web_assets.py, strings and data in flash
+struct WebAsset
+{
+  uint32_t PathHash; // Checksum::fnv1a
+  PGM_P Path;
+  PGM_P ETag; // 8 hex digits
+  const uint8_t *Data;
+  uint32_t Length;
+  ContentType Type;
+  bool Gzip;
+};
+
 class ApiMethodResponse
 {
 public:
   ErrorState Error = ErrorState::None;
   ResponseType Type = ResponseType::Empty;
   String Body = "";
+  String ETag = "";
+};
+
+// State of an async api handler, kept across handle() calls. The handler
+// is called until it returns true, back to back while the slice lasts;
+// Stage is its own resume point and starts at zero. A step that can't be
+// split still runs whole, so keep each one short.
+class ApiTask
+{
+public:
+  String RequestBody = "";
+  ApiMethodResponse Response;
+  uint8_t Stage = 0;
+
+  bool Expired() { return micros() - _sliceStart >= WEBSERVER_SLICE_US; }
+
+private:
+  friend class WebServer;
+  uint32_t _sliceStart = 0;
 };
 
 class ApiMethod
 {
 public:
   typedef std::function<ApiMethodResponse(String&)> CallbackFunction;
+  typedef std::function<bool(ApiTask&)> TaskFunction;
   CallbackFunction Callback;
-  String Path;
+  TaskFunction Task; // used instead of Callback when set
+  String Path; // a trailing "/*" matches one path segment, see WebServer::PathParameter()
 };
 
 class WebServer
@@ -52,11 +93,17 @@ class WebServer
 public:
   WebServer(WiFiServer *server);
   bool handle();
+  void IndexFiles();
 
   void SetGetHandlers(ApiMethod *apiMethods, uint8_t count);
   void SetPutHandlers(ApiMethod *apiMethods, uint8_t count);
   void SetPostHandlers(ApiMethod *apiMethods, uint8_t count);
   void SetDeleteHandlers(ApiMethod *apiMethods, uint8_t count);
+  void SetPatchHandlers(ApiMethod *apiMethods, uint8_t count);
+
+  // valid for the duration of an api callback or task
+  const String &PathParameter();
+  const String &IfMatch();
 
 private:
   void loop();
@@ -66,8 +113,10 @@ private:
   void resetState();
 
   void readClientRequestHeader();
+  bool acceptsGzip(const char *codings);
   void clearClientBuffer();
-  bool isFileNameLegal(String path);
+  bool isFileNameLegal(const String &path);
+  long queryParameter(const char *name, long fallback);
 
   void parseRequestHeader();
   void selectRequestMethod();
@@ -76,13 +125,22 @@ private:
   void selectRequestPath_PUT();
   void selectRequestPath_POST();
   void selectRequestPath_DELETE();
+  void selectRequestPath_PATCH();
+  bool selectApiMethod(ApiMethod *apiMethods, uint8_t count);
+  bool matchPath(const String &pattern);
 
   void serve_GET_fileList();
+  size_t writeFileListEntry(uint8_t index, bool first, WiFiClient *client);
   void serve_GET_file();
+  bool serve_GET_asset(const String &path);
   void serve_PUT_file();
   void serve_DELETE_file();
 
   void serve_api(ApiMethod::CallbackFunction fn);
+  void serve_api_task(ApiMethod::TaskFunction fn);
+  void continue_api_task();
+  String readRequestBody();
+  void writeApiResponse(ApiMethodResponse &response);
 
   ApiMethod *_api_GETs;
   uint8_t _api_GETsLength;
@@ -92,6 +150,8 @@ private:
   uint8_t _api_POSTsLength;
   ApiMethod *_api_DELETEs;
   uint8_t _api_DELETEsLength;
+  ApiMethod *_api_PATCHes;
+  uint8_t _api_PATCHesLength;
 
   enum class ProcessStep : uint8_t
   {
@@ -115,16 +175,29 @@ private:
     RequestMethod_DELETE = 40,
     ProcessRequest_DELETE = 41,
     EndRequest_DELETE = 42,
+
+    RequestMethod_PATCH = 50,
+    ProcessRequest_PATCH = 51,
+    EndRequest_PATCH = 52,
   };
 
   WiFiServer *_server;
+  FileIndex _files;
 
   WiFiClient _client;
   String _requestHeader = "";
   String _requestHeaderParts[3];
+  String _requestIfMatch = "";
+  String _requestIfNoneMatch = "";
+  bool _requestAcceptsGzip = false;
+  String _pathParameter = "";
   ProcessStep _processStep = ProcessStep::AwaitClient;
   ErrorState _errorState = ErrorState::None;
   bool _errorHandled = false;
+
+  // holds the request at its ProcessRequest step until the task is done
+  ApiMethod::TaskFunction _taskFunction = nullptr;
+  ApiTask _task;
 };
 
 #endif
@@ -3,13 +3,52 @@
   Copyright 2019, SytheZN, All rights reserved.
 */
 #include "WebServer.h"
+#include "Checksum.h"
+#include "Log.h"
+
+// generated from web/ by tools/build_web_assets.py
+#if __has_include("WebAssets.h")
+#include "WebAssets.h"
+#endif
+
+// characters allowed in names under /file/: 0-9, a-z and '.'
+struct FileNameChars
+{
+  bool Legal[256];
+
+  constexpr FileNameChars() : Legal()
+  {
+    for (int c = '0'; c <= '9'; c++)
+      Legal[c] = true;
+    for (int c = 'a'; c <= 'z'; c++)
+      Legal[c] = true;
+    Legal['.'] = true;
+  }
+};
+
+static constexpr FileNameChars fileNameChars;
 
 WebServer::WebServer(WiFiServer *server)
-    : _api_GETs(NULL), _api_GETsLength(0), _api_PUTs(NULL), _api_PUTsLength(0), _api_POSTs(NULL), _api_POSTsLength(0), _api_DELETEs(NULL), _api_DELETEsLength(0)
+    : _api_GETs(NULL), _api_GETsLength(0), _api_PUTs(NULL), _api_PUTsLength(0), _api_POSTs(NULL), _api_POSTsLength(0), _api_DELETEs(NULL), _api_DELETEsLength(0), _api_PATCHes(NULL), _api_PATCHesLength(0)
 {
   _server = server;
 }
 
+// rebuilds the file index from SPIFFS; call once it's mounted, and again after a format
+void WebServer::IndexFiles()
+{
+  _files.clear();
+
+  auto dir = SPIFFS.openDir("");
+  while (dir.next())
+  {
+    const String name = dir.fileName();
+    if (isFileNameLegal(name))
+      _files.update(name.c_str(), dir.fileSize());
+  }
+  LOG_INFO("FS: %u files indexed%s", _files.count(), _files.complete() ? "" : ", index full");
+}
+
 bool WebServer::handle()
 {
   if (_processStep != ProcessStep::AwaitClient || _errorState != ErrorState::None || _client)
@@ -60,6 +99,25 @@ void WebServer::SetDeleteHandlers(ApiMethod *apiMethods, uint8_t count)
   _api_DELETEs = apiMethods;
   _api_DELETEsLength = count;
 }
+void WebServer::SetPatchHandlers(ApiMethod *apiMethods, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    apiMethods[i].Path = "/api/" + apiMethods[i].Path;
+    apiMethods[i].Path.toLowerCase();
+  }
+  _api_PATCHes = apiMethods;
+  _api_PATCHesLength = count;
+}
+
+const String &WebServer::PathParameter()
+{
+  return _pathParameter;
+}
+const String &WebServer::IfMatch()
+{
+  return _requestIfMatch;
+}
 
 void WebServer::loop()
 {
@@ -69,96 +127,78 @@ void WebServer::loop()
     return;
   }
 
+  if (_taskFunction)
+  {
+    continue_api_task();
+    return;
+  }
+
   _processStep = (ProcessStep)(((uint8_t)_processStep) + 1);
   switch (_processStep)
   {
   case ProcessStep::GetRequestHeader:
-    Serial.print("Client connected: ");
-    Serial.println(_client.remoteIP().toString());
+    LOG_DEBUG("Client connected: %s", _client.remoteIP().toString());
     readClientRequestHeader();
     break;
 
   case ProcessStep::ParseRequestHeader:
-    Serial.print("Got request: ");
-    Serial.println(_requestHeader);
+    LOG_INFO("Got request: %s", _requestHeader);
     parseRequestHeader();
     break;
 
   case ProcessStep::SelectRequestMethodHandler:
-    Serial.println("Request Parameters:");
-    Serial.print("  Method: ");
-    Serial.println(_requestHeaderParts[0]);
-    Serial.print("  Path:   ");
-    Serial.println(_requestHeaderParts[1]);
-    Serial.print("  Proto:  ");
-    Serial.println(_requestHeaderParts[2]);
+    LOG_DEBUG("Request method '%s' path '%s' proto '%s'", _requestHeaderParts[0], _requestHeaderParts[1], _requestHeaderParts[2]);
     selectRequestMethod();
     break;
 
   case ProcessStep::ProcessRequest_GET:
-    Serial.println("Enter GET");
+    LOG_DEBUG("Enter GET");
     selectRequestPath_GET();
     break;
   case ProcessStep::ProcessRequest_POST:
-    Serial.println("Enter POST");
+    LOG_DEBUG("Enter POST");
     selectRequestPath_POST();
     break;
   case ProcessStep::ProcessRequest_PUT:
-    Serial.println("Enter PUT");
+    LOG_DEBUG("Enter PUT");
     selectRequestPath_PUT();
     break;
   case ProcessStep::ProcessRequest_DELETE:
-    Serial.println("Enter DELETE");
+    LOG_DEBUG("Enter DELETE");
     selectRequestPath_DELETE();
     break;
+  case ProcessStep::ProcessRequest_PATCH:
+    LOG_DEBUG("Enter PATCH");
+    selectRequestPath_PATCH();
+    break;
 
   case ProcessStep::EndRequest_GET:
   case ProcessStep::EndRequest_POST:
   case ProcessStep::EndRequest_PUT:
   case ProcessStep::EndRequest_DELETE:
-    Serial.println("Graceful disconnect.\n");
+  case ProcessStep::EndRequest_PATCH:
+    LOG_DEBUG("Graceful disconnect");
     _client.stop();
     resetState();
     return;
 
   default:
     // something went wrong, but the _client is still connected.
-    Serial.printf("processStep out of bounds: %d\r\nDisconnecting _client.\n\r\n", _processStep);
+    LOG_ERROR("processStep out of bounds: %d, disconnecting client", (uint8_t)_processStep);
     _client.stop();
     resetState();
     return;
   }
 }
 
-bool WebServer::isFileNameLegal(String path)
+bool WebServer::isFileNameLegal(const String &path)
 {
-  const char legalChars[] = "0123456789abcdefghijklmnopqrstuvwxyz.";
-
-  bool isLegal = true;
-  bool periodFound = false;
-
-  for (int pathIndex = 0; pathIndex < path.length(); pathIndex++)
+  for (const char c : path)
   {
-    bool isLegalChar = false;
-    for (uint8_t legalIndex = 0; legalIndex < 38; legalIndex++)
-    {
-      if (path[pathIndex] == legalChars[legalIndex])
-        isLegalChar = true;
-    }
-
-    if (path[pathIndex] == legalChars[37])
-    {
-      if (!periodFound)
-        periodFound = true;
-      else
-        isLegal = false;
-    }
-
-    if (!isLegalChar)
-      isLegal = false;
+    if (!fileNameChars.Legal[(uint8_t)c])
+      return false;
   }
-
-  return isLegal;
+  return true;
 }
 void WebServer::clearClientBuffer()
 {
@@ -177,7 +217,7 @@ void WebServer::handleError()
   {
     if (_client.connected())
     {
-      Serial.println("Disconnecting client.\n");
+      LOG_DEBUG("Disconnecting client");
       _client.stop();
     }
     resetState();
@@ -187,41 +227,46 @@ void WebServer::handleError()
     switch (_errorState)
     {
     case ErrorState::ReadTimeout:
-      Serial.println("Read timeout");
+      LOG_INFO("Read timeout");
       break;
 
     case ErrorState::BadRequest:
       writeError("400 Bad Request");
-      Serial.println("Returned 400 Bad Request");
+      LOG_INFO("Returned 400 Bad Request");
       break;
 
     case ErrorState::MethodNotAllowed:
       writeError("405 Method Not Allowed");
-      Serial.println("Returned 405 Method Not Allowed");
+      LOG_INFO("Returned 405 Method Not Allowed");
       break;
 
     case ErrorState::NotAcceptable:
       writeError("406 Not Acceptable");
-      Serial.println("Returned 406 Not Acceptable");
+      LOG_INFO("Returned 406 Not Acceptable");
       break;
 
     case ErrorState::Conflict:
       writeError("409 Conflict");
-      Serial.println("Returned 409 Conflict");
+      LOG_INFO("Returned 409 Conflict");
       break;
 
     case ErrorState::NotFound:
       writeError("404 Not Found");
-      Serial.println("Returned 404 Not Found");
+      LOG_INFO("Returned 404 Not Found");
       break;
 
     case ErrorState::InternalServerError:
       writeError("500 Internal Server Error");
-      Serial.println("Returned 500 Internal Server Error");
+      LOG_INFO("Returned 500 Internal Server Error");
+      break;
+
+    case ErrorState::PreconditionFailed:
+      writeError("412 Precondition Failed");
+      LOG_INFO("Returned 412 Precondition Failed");
       break;
 
     default:
-      Serial.printf("errorState out of bounds: %d\r\n");
+      LOG_ERROR("errorState out of bounds: %d", (uint8_t)_errorState);
     }
     _errorHandled = true;
   }
@@ -237,9 +282,15 @@ void WebServer::resetState()
   _requestHeaderParts[0] = "";
   _requestHeaderParts[1] = "";
   _requestHeaderParts[2] = "";
+  _requestIfMatch = "";
+  _requestIfNoneMatch = "";
+  _requestAcceptsGzip = false;
+  _pathParameter = "";
   _processStep = ProcessStep::AwaitClient;
   _errorState = ErrorState::None;
   _errorHandled = false;
+  _taskFunction = nullptr;
+  _task = ApiTask();
 }
 
 void WebServer::readClientRequestHeader()
@@ -265,12 +316,72 @@ void WebServer::readClientRequestHeader()
           _client.read();
           break;
         }
+
+        line.trim();
+        if (line.length() > 9 && strncasecmp(line.c_str(), "if-match:", 9) == 0)
+        {
+          _requestIfMatch = line.substring(9);
+          _requestIfMatch.trim();
+        }
+        else if (line.length() > 14 && strncasecmp(line.c_str(), "if-none-match:", 14) == 0)
+        {
+          _requestIfNoneMatch = line.substring(14);
+          _requestIfNoneMatch.trim();
+        }
+        else if (line.length() > 16 && strncasecmp(line.c_str(), "accept-encoding:", 16) == 0)
+        {
+          _requestAcceptsGzip = acceptsGzip(line.c_str() + 16);
+        }
       }
     }
     else
       yield();
   }
 }
+// codings is an Accept-Encoding list, e.g. "gzip;q=0.5, br". gzip, or
+// failing that "*", is acceptable unless its q-value is zero.
+bool WebServer::acceptsGzip(const char *codings)
+{
+  int8_t gzip = -1, any = -1; // -1 unlisted, 0 refused, 1 accepted
+
+  while (*codings)
+  {
+    while (*codings == ' ' || *codings == ',')
+      codings++;
+    const char *name = codings;
+    while (*codings && *codings != ';' && *codings != ',' && *codings != ' ')
+      codings++;
+    const size_t nameLength = codings - name;
+
+    bool accepted = true;
+    while (*codings && *codings != ',')
+    {
+      if (*codings == ';')
+      {
+        codings++;
+        while (*codings == ' ')
+          codings++;
+        if (strncasecmp(codings, "q=", 2) == 0)
+        {
+          // q is 0 to 1 with up to three decimals, zero unless a digit isn't
+          accepted = false;
+          for (codings += 2; (*codings >= '0' && *codings <= '9') || *codings == '.'; codings++)
+            if (*codings > '0' && *codings <= '9')
+              accepted = true;
+        }
+      }
+      else
+        codings++;
+    }
+
+    if ((nameLength == 4 && strncasecmp(name, "gzip", 4) == 0) || (nameLength == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+      gzip = accepted;
+    else if (nameLength == 1 && *name == '*')
+      any = accepted;
+  }
+
+  return gzip >= 0 ? gzip : any > 0;
+}
 
 void WebServer::parseRequestHeader()
 {
@@ -317,6 +428,10 @@ void WebServer::selectRequestMethod()
   {
     _processStep = ProcessStep::RequestMethod_DELETE;
   }
+  else if (_requestHeaderParts[0] == "PATCH")
+  {
+    _processStep = ProcessStep::RequestMethod_PATCH;
+  }
   else
   {
     _errorState = ErrorState::MethodNotAllowed;
@@ -325,28 +440,23 @@ void WebServer::selectRequestMethod()
 
 void WebServer::selectRequestPath_GET()
 {
-  if (_requestHeaderParts[1] == "/filelist")
+  if (_requestHeaderParts[1] == "/filelist" || _requestHeaderParts[1].startsWith("/filelist?"))
   {
     serve_GET_fileList();
     return;
   }
 
+  if (_requestHeaderParts[1] == "/")
+    _requestHeaderParts[1] = "/file/index.html";
+
   if (_requestHeaderParts[1].startsWith("/file/"))
   {
     serve_GET_file();
     return;
   }
 
-  for (uint8_t i = 0; i < _api_GETsLength; i++)
-  {
-    Serial.println("Compare selector: '" + _api_GETs[i].Path + "'");
-    if (_requestHeaderParts[1] == _api_GETs[i].Path)
-    {
-      Serial.println("  Match");
-      serve_api(_api_GETs[i].Callback);
-      return;
-    }
-  }
+  if (selectApiMethod(_api_GETs, _api_GETsLength))
+    return;
 
   _errorState = ErrorState::NotFound;
   return;
@@ -359,32 +469,16 @@ void WebServer::selectRequestPath_PUT()
     return;
   }
 
-  for (uint8_t i = 0; i < _api_PUTsLength; i++)
-  {
-    Serial.println("Compare selector: '" + _api_PUTs[i].Path + "'");
-    if (_requestHeaderParts[1] == _api_PUTs[i].Path)
-    {
-      Serial.println("  Match");
-      serve_api(_api_PUTs[i].Callback);
-      return;
-    }
-  }
+  if (selectApiMethod(_api_PUTs, _api_PUTsLength))
+    return;
 
   _errorState = ErrorState::NotFound;
   return;
 }
 void WebServer::selectRequestPath_POST()
 {
-  for (uint8_t i = 0; i < _api_POSTsLength; i++)
-  {
-    Serial.println("Compare selector: '" + _api_POSTs[i].Path + "'");
-    if (_requestHeaderParts[1] == _api_POSTs[i].Path)
-    {
-      Serial.println("  Match");
-      serve_api(_api_POSTs[i].Callback);
-      return;
-    }
-  }
+  if (selectApiMethod(_api_POSTs, _api_POSTsLength))
+    return;
 
   _errorState = ErrorState::NotFound;
   return;
@@ -397,43 +491,119 @@ void WebServer::selectRequestPath_DELETE()
     return;
   }
 
-  for (uint8_t i = 0; i < _api_DELETEsLength; i++)
+  if (selectApiMethod(_api_DELETEs, _api_DELETEsLength))
+    return;
+
+  _errorState = ErrorState::NotFound;
+  return;
+}
+
+void WebServer::selectRequestPath_PATCH()
+{
+  if (selectApiMethod(_api_PATCHes, _api_PATCHesLength))
+    return;
+
+  _errorState = ErrorState::NotFound;
+  return;
+}
+bool WebServer::selectApiMethod(ApiMethod *apiMethods, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
   {
-    Serial.println("Compare selector: '" + _api_DELETEs[i].Path + "'");
-    if (_requestHeaderParts[1] == _api_DELETEs[i].Path)
+    LOG_DEBUG("Compare selector: '%s'", apiMethods[i].Path);
+    if (matchPath(apiMethods[i].Path))
     {
-      Serial.println("  Match");
-      serve_api(_api_DELETEs[i].Callback);
-      return;
+      LOG_DEBUG("  Match");
+      if (apiMethods[i].Task)
+        serve_api_task(apiMethods[i].Task);
+      else
+        serve_api(apiMethods[i].Callback);
+      return true;
     }
   }
+  return false;
+}
+bool WebServer::matchPath(const String &pattern)
+{
+  const String &path = _requestHeaderParts[1];
 
-  _errorState = ErrorState::NotFound;
-  return;
+  if (!pattern.endsWith("/*"))
+    return path == pattern;
+
+  // wildcard matches exactly one non-empty segment
+  const uint prefixLength = pattern.length() - 1;
+  if (path.length() <= prefixLength || strncmp(path.c_str(), pattern.c_str(), prefixLength) != 0 || path.indexOf('/', prefixLength) >= 0)
+    return false;
+
+  _pathParameter = path.substring(prefixLength);
+  return true;
 }
 
+// GET /filelist?start=0&count=16, a page of the index as json; "next" is
+// where the following page starts, absent on the last one. count is at
+// least 1 so "next" always moves forward.
 void WebServer::serve_GET_fileList()
 {
+  const long startParameter = queryParameter("start", 0);
+  const long countParameter = queryParameter("count", WEBSERVER_FILE_LIST_PAGE);
+  const uint8_t start = constrain(startParameter, 0L, (long)_files.count());
+  const uint8_t end = min((long)start + constrain(countParameter, 1L, 255L), (long)_files.count());
   FSInfo info;
   SPIFFS.info(info);
-  String fileList = "";
-  fileList += String(info.totalBytes - info.usedBytes);
-  fileList += " bytes available of ";
-  fileList += String(info.totalBytes);
-  auto dir = SPIFFS.openDir("");
-  fileList += "\r\n\r\nFiles:\r\n";
 
-  while (dir.next())
+  char head[96];
+  char tail[32];
+  const int headLength = snprintf(head, sizeof(head), "{\"free\":%u,\"total\":%u,\"complete\":%s,\"files\":[",
+                                  (unsigned)(info.totalBytes - info.usedBytes), (unsigned)info.totalBytes, _files.complete() ? "true" : "false");
+  const int tailLength = end < _files.count() ? snprintf(tail, sizeof(tail), "],\"next\":%u}", end) : snprintf(tail, sizeof(tail), "]}");
+
+  // sized first so the entries can be streamed without holding them all
+  size_t length = headLength + tailLength;
+  for (uint8_t i = start; i < end; i++)
+    length += writeFileListEntry(i, i == start, nullptr);
+
+  clearClientBuffer();
+  _client.printf("HTTP/1.1 200 OK\r\nContent-Length: %u\r\nContent-Type: application/json\r\n\r\n", (unsigned)length);
+  _client.write((const uint8_t *)head, headLength);
+  for (uint8_t i = start; i < end; i++)
+    writeFileListEntry(i, i == start, &_client);
+  _client.write((const uint8_t *)tail, tailLength);
+}
+// returns the entry's length, and writes it if given a client
+size_t WebServer::writeFileListEntry(uint8_t index, bool first, WiFiClient *client)
+{
+  const FileEntry &file = _files.entry(index);
+  const char *mime = FileIndex::mimeType(file.Type);
+  char entry[128];
+
+  // names are restricted to characters that need no escaping
+  const int length = snprintf(entry, sizeof(entry), "%s{\"name\":\"%s\",\"size\":%u,\"type\":\"%s\"}",
+                              first ? "" : ",", file.Name, (unsigned)file.Size, mime ? mime : "");
+  if (client)
+    client->write((const uint8_t *)entry, length);
+  return length;
+}
+// the value of name in the request's query string, or fallback if it's missing or not a number
+long WebServer::queryParameter(const char *name, long fallback)
+{
+  const String &target = _requestHeaderParts[1];
+  const int query = target.indexOf('?');
+  if (query < 0)
+    return fallback;
+
+  const size_t nameLength = strlen(name);
+  for (int at = query + 1; at > 0 && at < (int)target.length();)
   {
-    fileList += "    ";
-    fileList += dir.fileName();
-    fileList += "    ";
-    fileList += String(dir.fileSize());
-    fileList += "\r\n";
+    if (strncmp(target.c_str() + at, name, nameLength) == 0 && target[at + nameLength] == '=')
+    {
+      const char *value = target.c_str() + at + nameLength + 1;
+      char *valueEnd;
+      const long result = strtol(value, &valueEnd, 10);
+      return valueEnd != value && result >= 0 ? result : fallback;
+    }
+    at = target.indexOf('&', at) + 1;
   }
-  clearClientBuffer();
-  _client.printf("HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: text/plain\r\n\r\n", fileList.length());
-  _client.print(fileList);
+  return fallback;
 }
 void WebServer::serve_GET_file()
 {
@@ -446,7 +616,13 @@ void WebServer::serve_GET_file()
     return;
   }
 
-  if (!SPIFFS.exists(path))
+#ifdef WEB_ASSET_COUNT
+  if (serve_GET_asset(path))
+    return;
+#endif
+
+  const FileEntry *entry = _files.find(path.c_str());
+  if (!entry && (_files.complete() || !SPIFFS.exists(path)))
   {
     _errorState = ErrorState::NotFound;
     return;
@@ -455,7 +631,7 @@ void WebServer::serve_GET_file()
   auto f = SPIFFS.open(path, "r");
   if (!f)
   {
-    Serial.println("FS: Failed to open '" + path + "'");
+    LOG_WARN("FS: Failed to open '%s'", path);
     _errorState = ErrorState::InternalServerError;
     return;
   }
@@ -463,14 +639,9 @@ void WebServer::serve_GET_file()
   clearClientBuffer();
   _client.printf("HTTP/1.1 200 OK\r\nContent-Length: %d\r\n", f.size());
 
-  if (path.endsWith(".html") || path.endsWith(".htm"))
-    _client.println("Content-Type: text/html");
-  if (path.endsWith(".jpg") || path.endsWith(".jpeg"))
-    _client.println("Content-Type: image/jpeg");
-  if (path.endsWith(".png"))
-    _client.println("Content-Type: image/png");
-  if (path.endsWith(".js"))
-    _client.println("Content-Type: application/javascript");
+  const char *mime = FileIndex::mimeType(entry ? entry->Type : FileIndex::typeOf(path.c_str()));
+  if (mime)
+    _client.printf("Content-Type: %s\r\n", mime);
 
   _client.println();
 
@@ -485,6 +656,50 @@ void WebServer::serve_GET_file()
     remaining -= chunk;
   }
 }
+#ifdef WEB_ASSET_COUNT
+// Compiled-in assets shadow SPIFFS files of the same name. A gzipped asset
+// is passed over for a client that doesn't take gzip, so an uncompressed
+// copy in SPIFFS can still answer it. Browsers revalidate on every load
+// and get a 304 while the ETag still matches, so the page costs no flash
+// reads at all until the firmware changes.
+bool WebServer::serve_GET_asset(const String &path)
+{
+  const uint32_t hash = Checksum::fnv1a(path.c_str());
+
+  for (const WebAsset &asset : webAssets)
+  {
+    if (asset.PathHash != hash || strcmp_P(path.c_str(), asset.Path) != 0)
+      continue;
+    if (asset.Gzip && !_requestAcceptsGzip)
+      return false;
+
+    char etag[12];
+    strncpy_P(etag + 1, asset.ETag, 9);
+    etag[0] = '"';
+    etag[9] = '"';
+    etag[10] = 0;
+
+    clearClientBuffer();
+    if (_requestIfNoneMatch == etag)
+    {
+      _client.printf("HTTP/1.1 304 Not Modified\r\nETag: %s\r\n\r\n", etag);
+      return true;
+    }
+
+    _client.printf("HTTP/1.1 200 OK\r\nContent-Length: %u\r\nETag: %s\r\nCache-Control: no-cache\r\n", (unsigned)asset.Length, etag);
+    const char *mime = FileIndex::mimeType(asset.Type);
+    if (mime)
+      _client.printf("Content-Type: %s\r\n", mime);
+    if (asset.Gzip)
+      _client.println("Content-Encoding: gzip");
+    _client.println();
+
+    _client.write_P((PGM_P)asset.Data, asset.Length);
+    return true;
+  }
+  return false;
+}
+#endif
 void WebServer::serve_PUT_file()
 {
   String path = _requestHeaderParts[1];
@@ -499,14 +714,14 @@ void WebServer::serve_PUT_file()
   auto f = SPIFFS.open(path, "w");
   if (!f)
   {
-    Serial.println("FS: Failed to open '" + path + "'");
+    LOG_WARN("FS: Failed to open '%s'", path);
     _errorState = ErrorState::InternalServerError;
     return;
   }
   if (f.size() != 0)
   {
     f.close();
-    Serial.println("FS: file already contains data '" + path + "'");
+    LOG_WARN("FS: file already contains data '%s'", path);
     _errorState = ErrorState::Conflict;
     return;
   }
@@ -518,6 +733,7 @@ void WebServer::serve_PUT_file()
     delay(0);
   }
   f.flush();
+  _files.update(path.c_str(), f.size());
   f.close();
 
   _client.println("HTTP/1.1 200 OK\r\nConnection: Closed\r\n");
@@ -533,13 +749,14 @@ void WebServer::serve_DELETE_file()
     return;
   }
 
-  if (!SPIFFS.exists(path))
+  if (!_files.find(path.c_str()) && (_files.complete() || !SPIFFS.exists(path)))
   {
     _errorState = ErrorState::NotFound;
     return;
   }
 
   SPIFFS.remove(path);
+  _files.remove(path.c_str());
 
   clearClientBuffer();
   _client.println("HTTP/1.1 200 OK\r\nConnection: Closed\r\n");
@@ -552,22 +769,56 @@ void WebServer::serve_api(ApiMethod::CallbackFunction fn)
 
   if (fn)
   {
-    String requestBody = "";
-    
-    if (_client.available())
-    {
-      Serial.println("  Read request body");
-      while (_client.available()){
-        requestBody += (char)_client.read();
-        delay(0);
-      }
-    }
+    String requestBody = readRequestBody();
 
-    Serial.print("  Call handler... ");
+    LOG_DEBUG("  Call handler");
     response = fn(requestBody);
-    Serial.println("done");
   }
 
+  writeApiResponse(response);
+}
+void WebServer::serve_api_task(ApiMethod::TaskFunction fn)
+{
+  _task = ApiTask();
+  _task.RequestBody = readRequestBody();
+  _taskFunction = fn;
+
+  LOG_DEBUG("  Start task");
+  continue_api_task();
+}
+// runs the task until it finishes or the slice is spent; loop() comes back here until it's done
+void WebServer::continue_api_task()
+{
+  bool done;
+
+  _task._sliceStart = micros();
+  do
+    done = _taskFunction(_task);
+  while (!done && !_task.Expired());
+
+  if (!done)
+    return;
+
+  LOG_DEBUG("  Task done");
+  _taskFunction = nullptr;
+  writeApiResponse(_task.Response);
+}
+String WebServer::readRequestBody()
+{
+  String requestBody = "";
+
+  if (_client.available())
+  {
+    LOG_DEBUG("  Read request body");
+    while (_client.available()){
+      requestBody += (char)_client.read();
+      delay(0);
+    }
+  }
+  return requestBody;
+}
+void WebServer::writeApiResponse(ApiMethodResponse &response)
+{
   if (response.Error != ErrorState::None)
   {
     _errorState = response.Error;
@@ -576,6 +827,8 @@ void WebServer::serve_api(ApiMethod::CallbackFunction fn)
 
   clearClientBuffer();
   _client.println("HTTP/1.1 200 OK");
+  if (response.ETag.length())
+    _client.printf("ETag: \"%s\"\r\n", response.ETag.c_str());
   switch (response.Type)
   {
   case ResponseType::Json:
@@ -589,7 +842,7 @@ void WebServer::serve_api(ApiMethod::CallbackFunction fn)
     return;
 
   default:
-    Serial.printf("response.Type out of bounds: %d\r\n", _processStep);
+    LOG_ERROR("response.Type out of bounds: %d", (uint8_t)response.Type);
     _errorState = ErrorState::InternalServerError;
     return;
   }
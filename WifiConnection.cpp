@@ -0,0 +1,242 @@
+/*
+  WifiConnection.cpp - Non-blocking station connection manager.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#include "WifiConnection.h"
+#include "Checksum.h"
+
+WifiConnection::WifiConnection()
+{
+}
+
+void WifiConnection::begin(const char *ssid, const char *pass)
+{
+  _ssid = ssid;
+  _pass = pass;
+
+  // every begin() would otherwise rewrite the credentials to flash, and the
+  // sdk's own reconnect would fight the backoff below
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  WiFi.mode(WIFI_STA);
+
+  _gotIpHandler = WiFi.onStationModeGotIP([this](const WiFiEventStationModeGotIP &event) {
+    _gotIp = true;
+  });
+  _disconnectedHandler = WiFi.onStationModeDisconnected([this](const WiFiEventStationModeDisconnected &event) {
+    _disconnected = true;
+  });
+
+  _cacheValid = loadCache();
+  connect();
+}
+
+bool WifiConnection::update()
+{
+  uint32_t now = millis();
+  WifiState previous = _state;
+
+  switch (_state)
+  {
+  case WifiState::Connecting:
+    if (_gotIp)
+    {
+      IPAddress ip = WiFi.localIP();
+      // a link-local address means dhcp gave up, treat it as a failure
+      if (ip[0] == 169 && ip[1] == 254)
+        fail();
+      else
+        established();
+    }
+    else if (_disconnected || now - _attemptStarted >= WIFI_CONNECT_TIMEOUT)
+    {
+      // auto reconnect is off, so a disconnect here ends the attempt
+      fail();
+    }
+    break;
+
+  case WifiState::Connected:
+    if (_disconnected || !WiFi.isConnected())
+    {
+      _disconnects++;
+      _attempt = 0;
+      connect();
+    }
+    break;
+
+  case WifiState::Backoff:
+    if (now - _backoffStarted >= _backoff)
+      connect();
+    break;
+
+  default:
+    break;
+  }
+
+  return _state != previous;
+}
+
+WifiState WifiConnection::state()
+{
+  return _state;
+}
+
+bool WifiConnection::connected()
+{
+  return _state == WifiState::Connected;
+}
+
+// attempts since the last successful connection
+uint16_t WifiConnection::attempt()
+{
+  return _attempt;
+}
+
+// ms left until the next attempt while backing off
+uint32_t WifiConnection::backoff()
+{
+  if (_state != WifiState::Backoff)
+    return 0;
+
+  uint32_t elapsed = millis() - _backoffStarted;
+  return elapsed >= _backoff ? 0 : _backoff - elapsed;
+}
+
+uint32_t WifiConnection::connects()
+{
+  return _connects;
+}
+
+uint32_t WifiConnection::failures()
+{
+  return _failures;
+}
+
+uint32_t WifiConnection::disconnects()
+{
+  return _disconnects;
+}
+
+uint32_t WifiConnection::fastConnects()
+{
+  return _fastConnects;
+}
+
+uint32_t WifiConnection::lastConnectTime()
+{
+  return _lastConnectTime;
+}
+
+uint32_t WifiConnection::minConnectTime()
+{
+  return _connects ? _minConnectTime : 0;
+}
+
+uint32_t WifiConnection::maxConnectTime()
+{
+  return _maxConnectTime;
+}
+
+uint32_t WifiConnection::averageConnectTime()
+{
+  return _connects ? _totalConnectTime / _connects : 0;
+}
+
+void WifiConnection::connect()
+{
+  _gotIp = false;
+  _disconnected = false;
+  _attempt++;
+  _attemptStarted = millis();
+  _fromCache = _cacheValid;
+  _state = WifiState::Connecting;
+
+  if (_fromCache)
+  {
+    WiFi.config(IPAddress(_cache.Ip), IPAddress(_cache.Gateway), IPAddress(_cache.Mask), IPAddress(_cache.Dns));
+    WiFi.begin(_ssid, _pass, _cache.Channel, _cache.Bssid);
+  }
+  else
+  {
+    // all zeroes switches back to dhcp
+    WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+    WiFi.begin(_ssid, _pass);
+  }
+}
+
+void WifiConnection::established()
+{
+  uint32_t elapsed = millis() - _attemptStarted;
+
+  _state = WifiState::Connected;
+  _attempt = 0;
+  _backoff = 0;
+  _disconnected = false;
+
+  _connects++;
+  if (_fromCache)
+    _fastConnects++;
+  _lastConnectTime = elapsed;
+  _totalConnectTime += elapsed;
+  if (elapsed < _minConnectTime)
+    _minConnectTime = elapsed;
+  if (elapsed > _maxConnectTime)
+    _maxConnectTime = elapsed;
+
+  saveCache();
+}
+
+void WifiConnection::fail()
+{
+  _failures++;
+  WiFi.disconnect();
+
+  if (_fromCache)
+  {
+    // the access point moved or the lease is gone, rescan straight away
+    clearCache();
+    connect();
+    return;
+  }
+
+  uint8_t shift = _attempt > 6 ? 6 : _attempt - 1;
+  _backoff = (uint32_t)WIFI_BACKOFF_MIN << shift;
+  if (_backoff > WIFI_BACKOFF_MAX)
+    _backoff = WIFI_BACKOFF_MAX;
+
+  _backoffStarted = millis();
+  _state = WifiState::Backoff;
+}
+
+bool WifiConnection::loadCache()
+{
+  if (!ESP.rtcUserMemoryRead(WIFI_RTC_OFFSET, (uint32_t *)&_cache, sizeof(_cache)))
+    return false;
+
+  return _cache.Magic == WIFI_RTC_MAGIC &&
+         _cache.Crc == Checksum::crc32((uint8_t *)&_cache, offsetof(WifiRtcCache, Crc));
+}
+
+void WifiConnection::saveCache()
+{
+  const uint8_t *bssid = WiFi.BSSID();
+
+  _cache.Magic = WIFI_RTC_MAGIC;
+  memcpy(_cache.Bssid, bssid, sizeof(_cache.Bssid));
+  _cache.Channel = WiFi.channel();
+  _cache.Reserved = 0;
+  _cache.Ip = WiFi.localIP();
+  _cache.Gateway = WiFi.gatewayIP();
+  _cache.Mask = WiFi.subnetMask();
+  _cache.Dns = WiFi.dnsIP();
+  _cache.Crc = Checksum::crc32((uint8_t *)&_cache, offsetof(WifiRtcCache, Crc));
+
+  _cacheValid = ESP.rtcUserMemoryWrite(WIFI_RTC_OFFSET, (uint32_t *)&_cache, sizeof(_cache));
+}
+
+void WifiConnection::clearCache()
+{
+  _cacheValid = false;
+  _cache.Magic = 0;
+  ESP.rtcUserMemoryWrite(WIFI_RTC_OFFSET, (uint32_t *)&_cache, sizeof(_cache));
+}
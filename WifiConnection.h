@@ -0,0 +1,108 @@
+/*
+  WifiConnection.h - Non-blocking station connection manager.
+  Copyright 2019, SytheZN, All rights reserved.
+*/
+#ifndef _WifiConnection_h
+#define _WifiConnection_h
+
+#include "Arduino.h"
+#include <ESP8266WiFi.h>
+
+#define WIFI_CONNECT_TIMEOUT 15000  // ms before an attempt counts as failed
+#define WIFI_BACKOFF_MIN 1000       // ms, doubled per consecutive failure
+#define WIFI_BACKOFF_MAX 60000
+
+// rtc user memory is addressed in 4 byte blocks, the first 32 belong to eboot
+#ifndef WIFI_RTC_OFFSET
+#define WIFI_RTC_OFFSET 32
+#endif
+#define WIFI_RTC_MAGIC 0x57494649   // "WIFI"
+
+enum class WifiState : uint8_t
+{
+  Idle = 0,
+  Connecting = 1,
+  Connected = 2,
+  Backoff = 3
+};
+
+// Last good association, kept in rtc memory so a reboot can skip the scan
+// (bssid/channel) and dhcp (ip config). Guarded by a crc so a cold boot's
+// garbage is never used.
+struct WifiRtcCache
+{
+  uint32_t Magic;
+  uint8_t Bssid[6];
+  uint8_t Channel;
+  uint8_t Reserved;
+  uint32_t Ip;
+  uint32_t Gateway;
+  uint32_t Mask;
+  uint32_t Dns;
+  uint32_t Crc;
+};
+
+// begin() starts the first attempt and returns immediately. update() is
+// called from loop() and only reads flags set by the sdk's event callbacks
+// plus a timer, so it never waits on the radio. Failed attempts back off
+// exponentially; an attempt from the rtc cache that fails drops the cache
+// and retries with a full scan and dhcp.
+class WifiConnection
+{
+public:
+  WifiConnection();
+
+  void begin(const char *ssid, const char *pass);
+  bool update();
+
+  WifiState state();
+  bool connected();
+  uint16_t attempt();
+  uint32_t backoff();
+
+  uint32_t connects();
+  uint32_t failures();
+  uint32_t disconnects();
+  uint32_t fastConnects();
+  uint32_t lastConnectTime();
+  uint32_t minConnectTime();
+  uint32_t maxConnectTime();
+  uint32_t averageConnectTime();
+
+private:
+  void connect();
+  void established();
+  void fail();
+
+  bool loadCache();
+  void saveCache();
+  void clearCache();
+
+  const char *_ssid = nullptr;
+  const char *_pass = nullptr;
+
+  WiFiEventHandler _gotIpHandler;
+  WiFiEventHandler _disconnectedHandler;
+  volatile bool _gotIp = false;
+  volatile bool _disconnected = false;
+
+  WifiState _state = WifiState::Idle;
+  WifiRtcCache _cache;
+  bool _cacheValid = false;
+  bool _fromCache = false;
+  uint32_t _attemptStarted = 0;
+  uint32_t _backoffStarted = 0;
+  uint32_t _backoff = 0;
+  uint16_t _attempt = 0;
+
+  uint32_t _connects = 0;
+  uint32_t _failures = 0;
+  uint32_t _disconnects = 0;
+  uint32_t _fastConnects = 0;
+  uint32_t _lastConnectTime = 0;
+  uint32_t _minConnectTime = 0xFFFFFFFF;
+  uint32_t _maxConnectTime = 0;
+  uint32_t _totalConnectTime = 0;
+};
+
+#endif
@@ -2,8 +2,6 @@
 #include "Arduino.h"
 #include "eagle_soc.h"
 
-#define BP_SWI 0x00008000
-
 #define GPIO_ON_ADDR 0x60000304
 #define GPIO_OFF_ADDR 0x60000308
 
@@ -25,32 +23,33 @@ static inline uint32_t _getCycleCount(void) {
   return ccount;
 }
 
-void ICACHE_RAM_ATTR swi_write_ext(uint8_t *data, uint16_t len, uint8_t repeat)
+// planes: two bit times per byte, high nibble first, a bit set for each strip
+// sending a one; masks maps a nibble to the GPIO bits it drives. Run r drives
+// runPins[r] up to bit time runEnds[r], so strips drop out as they finish.
+// Every active pin rises together, zeros fall at T0H and ones at T1H.
+void ICACHE_RAM_ATTR swi_write_planes(const uint8_t *planes, const uint32_t *masks, const uint32_t *runEnds, const uint32_t *runPins, uint8_t runs)
 {
-  uint32_t startTime, c;
+  uint32_t startTime = _getCycleCount() - CYCLES_TOTAL, c;
+  uint32_t i = 0;
 
-  for (uint16_t i = 0; i < (len * repeat); i++)
+  for (uint8_t r = 0; r < runs; r++)
   {
-    for (uint8_t mask = 0x80; mask; mask >>= 1)
+    const uint32_t active = runPins[r];
+
+    for (; i < runEnds[r]; i++)
     {
-      if (data[i % len] & mask)
-      {
-        // one = on -> 0.6us -> off -> 0.6us
-        while(((c = _getCycleCount()) - startTime) < CYCLES_TOTAL);
-        WRITE_PERI_REG(GPIO_ON_ADDR, BP_SWI);
-        startTime = c;
-        while(((c = _getCycleCount()) - startTime) < CYCLES_ONE);
-        WRITE_PERI_REG(GPIO_OFF_ADDR, BP_SWI);
-      }
-      else
-      {
-        // zero = on -> 0.3us -> off -> 0.9us
-        while(((c = _getCycleCount()) - startTime) < CYCLES_TOTAL);
-        WRITE_PERI_REG(GPIO_ON_ADDR, BP_SWI);
-        startTime = c;
-        while(((c = _getCycleCount()) - startTime) < CYCLES_ZERO);
-        WRITE_PERI_REG(GPIO_OFF_ADDR, BP_SWI);
-      }
+      const uint8_t plane = planes[i >> 1];
+      const uint32_t ones = masks[(i & 1) ? plane & 0x0F : plane >> 4];
+
+      // one = on -> 0.6us -> off -> 0.6us
+      // zero = on -> 0.3us -> off -> 0.9us
+      while(((c = _getCycleCount()) - startTime) < CYCLES_TOTAL);
+      WRITE_PERI_REG(GPIO_ON_ADDR, active);
+      startTime = c;
+      while(((c = _getCycleCount()) - startTime) < CYCLES_ZERO);
+      WRITE_PERI_REG(GPIO_OFF_ADDR, active & ~ones);
+      while(((c = _getCycleCount()) - startTime) < CYCLES_ONE);
+      WRITE_PERI_REG(GPIO_OFF_ADDR, ones);
     }
   }
 };
\ No newline at end of file
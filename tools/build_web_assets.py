@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""
+  build_web_assets.py - Compiles web/ into WebAssets.h for serving from flash.
+  Copyright 2019, SytheZN, All rights reserved.
+
+  Run from anywhere before building whenever web/ changes:
+
+    python3 tools/build_web_assets.py
+
+  Every file in web/ becomes a PROGMEM array served at /file/<name> (and
+  index.html at /) ahead of SPIFFS, which still serves anything uploaded
+  under other names. Names follow the /file/ rules: 0-9, a-z and '.', no
+  subdirectories. Html, css and svg lose comments, indentation and blank
+  lines; javascript is left as written. Files are gzipped when that makes
+  them smaller. With web/ missing or empty WebAssets.h is removed and the
+  sketch builds without compiled-in assets.
+"""
+import gzip
+import os
+import re
+import sys
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+LEGAL = re.compile(r"^[0-9a-z.]+$")
+
+# keep in step with FileIndex.cpp
+TYPES = {
+    ".html": "Html",
+    ".htm": "Html",
+    ".jpg": "Jpeg",
+    ".jpeg": "Jpeg",
+    ".png": "Png",
+    ".js": "Javascript",
+    ".css": "Css",
+    ".json": "Json",
+    ".svg": "Svg",
+    ".ico": "Icon",
+}
+
+
+# Checksum::fnv1a
+def fnv1a(text):
+    h = 2166136261
+    for b in text.encode():
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def minify(name, data):
+    extension = os.path.splitext(name)[1]
+    if extension not in (".html", ".htm", ".css", ".svg"):
+        return data
+    text = data.decode("utf-8")
+    if extension == ".css":
+        text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    else:
+        # <pre> and <textarea> keep their whitespace, so leave pages with them alone
+        if re.search(r"<(pre|textarea)\b", text, re.I):
+            return data
+        text = re.sub(r"<!--(?!\[).*?-->", "", text, flags=re.S)
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line).encode("utf-8")
+
+
+def c_bytes(data):
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "\n".join(rows)
+
+
+def main():
+    web = os.path.join(ROOT, "web")
+    out = os.path.join(ROOT, "WebAssets.h")
+    names = sorted(n for n in os.listdir(web) if os.path.isfile(os.path.join(web, n))) if os.path.isdir(web) else []
+
+    if not names:
+        if os.path.exists(out):
+            os.remove(out)
+        print("no web assets, WebAssets.h removed")
+        return
+
+    arrays = []
+    entries = []
+    total = 0
+    for i, name in enumerate(names):
+        if not LEGAL.match(name):
+            sys.exit("web/%s: names may only use 0-9, a-z and '.'" % name)
+        with open(os.path.join(web, name), "rb") as f:
+            raw = f.read()
+
+        data = minify(name, raw)
+        packed = gzip.compress(data, 9, mtime=0)
+        zipped = len(packed) < len(data)
+        if zipped:
+            data = packed
+
+        etag = "%08x" % zlib.crc32(data)
+        kind = TYPES.get(os.path.splitext(name)[1], "None")
+        arrays.append('static const char webAssetPath%d[] PROGMEM = "%s";\n'
+                      'static const char webAssetETag%d[] PROGMEM = "%s";\n'
+                      'static const uint8_t webAssetData%d[] PROGMEM = {\n%s\n};\n'
+                      % (i, name, i, etag, i, c_bytes(data)))
+        entries.append("    {0x%08x, webAssetPath%d, webAssetETag%d, webAssetData%d, %d, ContentType::%s, %s},"
+                       % (fnv1a(name), i, i, i, len(data), kind, "true" if zipped else "false"))
+        total += len(data)
+        print("%-24s %7d -> %7d%s" % (name, len(raw), len(data), " gz" if zipped else ""))
+
+    with open(out, "w") as f:
+        f.write("/*\n"
+                "  WebAssets.h - Generated by tools/build_web_assets.py from web/, do not edit.\n"
+                "*/\n"
+                "#ifndef _WebAssets_h\n"
+                "#define _WebAssets_h\n\n"
+                '#include "WebServer.h"\n\n'
+                "#define WEB_ASSET_COUNT %d\n\n" % len(names))
+        f.write("\n".join(arrays))
+        f.write("\nstatic constexpr WebAsset webAssets[WEB_ASSET_COUNT] = {\n%s\n};\n\n#endif\n" % "\n".join(entries))
+    print("%d assets, %d bytes of flash" % (len(names), total))
+
+
+if __name__ == "__main__":
+    main()
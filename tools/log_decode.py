@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""
+  log_decode.py - Decodes the binary log served at /api/debug/log.
+  Copyright 2019, SytheZN, All rights reserved.
+
+  Records hold the flash address of their format string rather than the
+  text, so decoding needs the elf of the exact firmware that wrote them
+  (the Arduino IDE leaves it in the build folder; Sketch > Export compiled
+  binary doesn't keep it).
+
+    curl -s http://alarm.local/api/debug/log | python3 tools/log_decode.py Alarm_V1.ino.elf
+"""
+import re
+import struct
+import sys
+
+LEVELS = " EWID"
+SPEC = re.compile(r"%(%|[-+ #0-9.]*)([hlLqjzt]*)([a-zA-Z])?")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise ValueError("not a 32 bit elf: " + path)
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, kind, _, addr, offset, size = struct.unpack_from("<IIIIII", self.data, shoff + i * shentsize)
+            if addr and kind != 8:  # SHT_NOBITS has nothing in the file
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b"\0", start)
+                return self.data[start:end].decode("latin-1")
+        return None
+
+
+def arguments(record, at):
+    while at < len(record):
+        tag = record[at]
+        at += 1
+        if tag == 1:
+            yield struct.unpack_from("<i", record, at)[0]; at += 4
+        elif tag == 2:
+            yield struct.unpack_from("<I", record, at)[0]; at += 4
+        elif tag == 3:
+            yield struct.unpack_from("<q", record, at)[0]; at += 8
+        elif tag == 4:
+            yield struct.unpack_from("<Q", record, at)[0]; at += 8
+        elif tag == 5:
+            yield struct.unpack_from("<f", record, at)[0]; at += 4
+        elif tag == 6:
+            n = record[at]
+            yield record[at + 1:at + 1 + n].decode("latin-1"); at += 1 + n
+        else:
+            return  # unknown tag, nothing after it can be trusted
+
+
+# same rules as Log::format(): values follow their tags, not the conversions
+def format_record(elf, record):
+    level, time, address = struct.unpack_from("<BII", record, 1)
+    text = elf.string(address)
+    if text is None:
+        return "%5u.%03u %s <format 0x%08x not in elf>" % (time // 1000, time % 1000, LEVELS[level] if level < len(LEVELS) else " ", address)
+
+    args = arguments(record, 10)
+
+    def substitute(match):
+        flags, _, conversion = match.groups()
+        if flags == "%":
+            return "%"
+        value = next(args, None)
+        if value is None:
+            return "?"
+        if isinstance(value, str):
+            return ("%" + flags + "s") % value
+        if isinstance(value, float):
+            return ("%" + flags + (conversion if conversion in "eEfgG" else "g")) % value
+        if conversion == "c":
+            return chr(value & 0xFF)
+        if conversion in ("x", "X", "o"):
+            return ("%" + flags + conversion) % (value & 0xFFFFFFFFFFFFFFFF if value < 0 else value)
+        return ("%" + flags + "d") % value
+
+    return "%5u.%03u %s %s" % (time // 1000, time % 1000, LEVELS[level] if level < len(LEVELS) else " ", SPEC.sub(substitute, text))
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("usage: log_decode.py firmware.elf [dump.txt]")
+    elf = Elf(sys.argv[1])
+    source = open(sys.argv[2]) if len(sys.argv) == 3 else sys.stdin
+    for line in source:
+        line = line.strip()
+        if line:
+            print(format_record(elf, bytes.fromhex(line)))
+
+
+if __name__ == "__main__":
+    main()